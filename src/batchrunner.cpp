@@ -0,0 +1,97 @@
+#include "batchrunner.h"
+
+#include <vector>
+#include <chrono>
+#include <algorithm>
+
+#include "utils.h"
+#include "random.h"
+#include "orderedpipeline.h"
+#include "models/mnemonicmarkov.h"
+
+
+BatchRunner::BatchRunner(const MarkovModel &model, Options options) {
+  this->model = &model;
+  this->options = options;
+}
+
+
+BatchSummary BatchRunner::runStream(istream &in, FILE *out, int jobCount) {
+  BatchSummary total;
+  long lineNumber = 0;
+
+  // Lines are read (and seeds drawn) one at a time in input order
+  auto source = [&](Job &job) {
+    string line;
+    while (getline(in, line)) {
+      lineNumber++;
+      size_t first = line.find_first_not_of(" \t\r");
+      if (first == string::npos) {
+        continue;
+      }
+      size_t last = line.find_last_not_of(" \t\r");
+      job.lineNumber = lineNumber;
+      job.constraint = line.substr(first, last - first + 1);
+      job.seed = options.getUseSeed() ? Random::makeGenerator()() : 0;
+      return true;
+    }
+    return false;
+  };
+
+  auto work = [this](Job &job) {
+    return runJob(job);
+  };
+
+  auto sink = [&](Record &record) {
+    fwrite(record.text.data(), 1, record.text.size(), out);
+    fflush(out);
+    total.constraintCount++;
+    total.emptyCount += (record.sentenceCount == 0) ? 1 : 0;
+    total.sentenceCount += record.sentenceCount;
+    total.compileTime += record.compileTime;
+    total.sampleTime += record.sampleTime;
+  };
+
+  OrderedPipeline<Job, Record>(jobCount, jobCount * 2).run(source, work, sink);
+  return total;
+}
+
+
+BatchRunner::Record BatchRunner::runJob(const Job &job) {
+  Record record;
+
+  auto startTime = chrono::steady_clock::now();
+  auto constrainedModel = MnemonicMarkovModel(*model, Utils::cleanConstraint(job.constraint), options);
+  if (options.getUseSeed()) {
+    constrainedModel.setSeed(job.seed);
+  }
+  auto compiledTime = chrono::steady_clock::now();
+  vector<vector<string> > sentences = constrainedModel.generateSentences(options);
+  auto sampledTime = chrono::steady_clock::now();
+
+  // A constraint without solutions samples placeholder sentences of empty words
+  sentences.erase(remove_if(sentences.begin(), sentences.end(), [](const vector<string> &sentence) {
+    return find(sentence.begin(), sentence.end(), "") != sentence.end();
+  }), sentences.end());
+
+  record.sentenceCount = (int)sentences.size();
+  record.compileTime = chrono::duration<double>(compiledTime - startTime).count();
+  record.sampleTime = chrono::duration<double>(sampledTime - compiledTime).count();
+
+  char fields[128];
+  snprintf(fields, sizeof(fields), "%ld\t%f\t%f\t%d\t", job.lineNumber,
+           record.compileTime, record.sampleTime, record.sentenceCount);
+  record.text = fields;
+  for (char c : job.constraint) {
+    record.text += (c == '\t') ? ' ' : c;
+  }
+  for (const auto &sentence : sentences) {
+    record.text += "\t";
+    for (int i = 0; i < (int)sentence.size(); i++) {
+      record.text += (i > 0) ? " " : "";
+      record.text += sentence[i];
+    }
+  }
+  record.text += "\n";
+  return record;
+}
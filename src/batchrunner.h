@@ -0,0 +1,88 @@
+#ifndef MARKOV_BATCHRUNNER_H
+#define MARKOV_BATCHRUNNER_H
+
+#include <string>
+#include <istream>
+#include <stdio.h>
+
+#include "options.h"
+#include "models/markov.h"
+
+using namespace std;
+
+
+/**
+ * @brief Totals of a batch run
+ */
+struct BatchSummary {
+  /// Constraints read
+  long constraintCount = 0;
+  /// Constraints that produced no sentence
+  long emptyCount = 0;
+  /// Sentences written
+  long sentenceCount = 0;
+  /// Summed wall time compiling constraints (seconds, across workers)
+  double compileTime = 0.0;
+  /// Summed wall time sampling sentences (seconds, across workers)
+  double sampleTime = 0.0;
+};
+
+
+/**
+ * @brief Generates sentences for a stream of constraints against a trained markov model
+ *
+ * Constraints are read one per line and compiled and sampled on worker
+ * threads, a bounded number at a time, each against the shared base
+ * model. Records are written in input order as they complete, so memory
+ * does not grow with the input.
+ */
+class BatchRunner {
+public:
+  /**
+   * @param model trained markov model (must outlive the runner)
+   * @param options sentence count and decoding options applied to every constraint
+   */
+  BatchRunner(const MarkovModel &model, Options options);
+
+  /**
+   * @brief Run every constraint of a stream
+   *
+   * Writes one tab separated record per non-blank line: line number,
+   * compile seconds, sample seconds, sentence count, the constraint and
+   * then one field per sentence
+   *
+   * @param in constraints, one per line
+   * @param out destination of the records
+   * @param jobCount constraints run concurrently
+   * @return BatchSummary totals
+   */
+  BatchSummary runStream(istream &in, FILE *out, int jobCount);
+
+private:
+  /// One constraint of the stream
+  struct Job {
+    long lineNumber;
+    string constraint;
+    uint64_t seed;
+  };
+
+  /// Result of one constraint
+  struct Record {
+    string text;
+    int sentenceCount;
+    double compileTime;
+    double sampleTime;
+  };
+
+  const MarkovModel *model;
+  Options options;
+
+  /**
+   * @brief Compile and sample one constraint
+   * @param job constraint to run
+   * @return Record formatted record and timings
+   */
+  Record runJob(const Job &job);
+};
+
+#endif
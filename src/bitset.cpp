@@ -0,0 +1,64 @@
+#include "bitset.h"
+
+Bitset::Bitset() {
+  this->bitCount = 0;
+}
+
+
+Bitset::Bitset(int size, bool value) {
+  this->bitCount = size;
+  this->blocks.assign((size + 63) / 64, value ? ~(uint64_t)0 : 0);
+
+  // Keep the unused tail bits cleared
+  if (value && size % 64 != 0) {
+    blocks.back() = ((uint64_t)1 << (size % 64)) - 1;
+  }
+}
+
+
+void Bitset::set(int index, bool value) {
+  if (value) {
+    blocks[index >> 6] |= (uint64_t)1 << (index & 63);
+  } else {
+    blocks[index >> 6] &= ~((uint64_t)1 << (index & 63));
+  }
+}
+
+
+int Bitset::count() const {
+  int count = 0;
+  for (uint64_t block : blocks) {
+    count += __builtin_popcountll(block);
+  }
+  return count;
+}
+
+
+Bitset &Bitset::operator&=(const Bitset &other) {
+  uint64_t *dst = blocks.data();
+  const uint64_t *src = other.blocks.data();
+  for (size_t i = 0, n = blocks.size(); i < n; i++) {
+    dst[i] &= src[i];
+  }
+  return *this;
+}
+
+
+Bitset &Bitset::operator|=(const Bitset &other) {
+  uint64_t *dst = blocks.data();
+  const uint64_t *src = other.blocks.data();
+  for (size_t i = 0, n = blocks.size(); i < n; i++) {
+    dst[i] |= src[i];
+  }
+  return *this;
+}
+
+
+Bitset &Bitset::andNot(const Bitset &other) {
+  uint64_t *dst = blocks.data();
+  const uint64_t *src = other.blocks.data();
+  for (size_t i = 0, n = blocks.size(); i < n; i++) {
+    dst[i] &= ~src[i];
+  }
+  return *this;
+}
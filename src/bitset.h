@@ -0,0 +1,88 @@
+#ifndef MARKOV_BITSET_H
+#define MARKOV_BITSET_H
+
+#include <vector>
+#include <stdint.h>
+
+using namespace std;
+
+/**
+ * @brief Dense fixed-size bitset stored in 64-bit blocks
+ *
+ * Bitwise operations run block by block over contiguous
+ * memory so the compiler can vectorize them
+ */
+class Bitset {
+public:
+  Bitset();
+
+  Bitset(int size, bool value = false);
+
+  /**
+   * @brief Get the number of bits
+   * @return int bit count
+   */
+  int size() const { return this->bitCount; }
+
+  /**
+   * @brief Set or clear a bit
+   * @param index bit index
+   * @param value value of the bit
+   */
+  void set(int index, bool value = true);
+
+  /**
+   * @brief Test a bit
+   * @param index bit index
+   * @return true if the bit is set
+   */
+  bool test(int index) const { return (blocks[index >> 6] >> (index & 63)) & 1; }
+
+  /**
+   * @brief Count the set bits
+   * @return int count of set bits
+   */
+  int count() const;
+
+  /**
+   * @brief Intersect with another bitset of the same size
+   * @param other bitset to intersect with
+   * @return Bitset& this bitset
+   */
+  Bitset &operator&=(const Bitset &other);
+
+  /**
+   * @brief Union with another bitset of the same size
+   * @param other bitset to union with
+   * @return Bitset& this bitset
+   */
+  Bitset &operator|=(const Bitset &other);
+
+  /**
+   * @brief Remove the bits set in another bitset of the same size
+   * @param other bitset to subtract
+   * @return Bitset& this bitset
+   */
+  Bitset &andNot(const Bitset &other);
+
+  /**
+   * @brief Call f(index) for every set bit in increasing order
+   * @param f function taking the bit index
+   */
+  template <class F>
+  void forEachSetBit(F f) const {
+    for (int i = 0; i < (int)blocks.size(); i++) {
+      uint64_t block = blocks[i];
+      while (block != 0) {
+        f((i << 6) + __builtin_ctzll(block));
+        block &= block - 1;
+      }
+    }
+  }
+
+private:
+  int bitCount;
+  vector<uint64_t> blocks;
+};
+
+#endif
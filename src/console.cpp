@@ -15,5 +15,5 @@ void Console::debugPrint(const char * format, ...) {
 }
 
 void Console::printHelp() {
-  printf("usage: markov [--debug | -d] [--constraint | -c] constraint [--markovorder | -m] [-n] [--cache] [--port | -p] [--server | -s] training_text\n");
+  printf("usage: markov [--debug | -d] [--constraint | -c] constraint [--markovorder | -m] [-n] [-l N] [--tokenlimit N] [--bytelimit N] [--cache] [--best] [--distinct] [--seed N] [--update FILE] [--keepsentences] [--ingestthreads N] [--layercache MB] [--sessiontimeout SECONDS] [--compilethreads N] [--jobs | -j N] [--score FILE] [--batch FILE | -] [--port | -p] [--server | -s] [--interactive | -i] training_text...\n");
 }
@@ -0,0 +1,201 @@
+#include "corpusreader.h"
+
+#include <algorithm>
+#include <iterator>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include "utils.h"
+#include "orderedpipeline.h"
+
+
+CorpusReader::CorpusReader(const vector<string> &paths) {
+  this->fileIndex = 0;
+  this->sentenceLimit = 0;
+  this->tokenLimit = 0;
+  this->byteLimit = 0;
+  this->isBudgetReached = false;
+  this->bytesRead = 0;
+  this->chunkSize = FIRST_CHUNK_SIZE;
+  this->paths = paths;
+  for (const auto &path : paths) {
+    addPath(path);
+  }
+}
+
+
+void CorpusReader::setLimits(int sentenceLimit, long tokenLimit, long byteLimit) {
+  this->sentenceLimit = max(0, sentenceLimit);
+  this->tokenLimit = max(0L, tokenLimit);
+  this->byteLimit = max(0L, byteLimit);
+}
+
+
+vector< vector<string> > CorpusReader::readSentences(int threadCount) {
+  fileIndex = 0;
+  if (file.is_open()) {
+    file.close();
+  }
+  carry.clear();
+  isBudgetReached = false;
+  bytesRead = 0;
+  chunkSize = FIRST_CHUNK_SIZE;
+
+  vector< vector<string> > sentences;
+  long tokenCount = 0;
+  auto source = [this](string &chunk) {
+    return !isBudgetReached && readChunk(chunk);
+  };
+  auto work = [this](string &chunk) {
+    // No chunk holds more sentences than the whole budget
+    return isBudgetReached ? vector< vector<string> >() : Utils::processTrainingSentences(chunk, sentenceLimit);
+  };
+  auto sink = [&](vector< vector<string> > &chunkSentences) {
+    for (auto &sentence : chunkSentences) {
+      if (isBudgetReached) {
+        break;
+      }
+      tokenCount += sentence.size();
+      sentences.push_back(move(sentence));
+      isBudgetReached = (sentenceLimit > 0 && (int)sentences.size() >= sentenceLimit) || (tokenLimit > 0 && tokenCount >= tokenLimit);
+    }
+  };
+
+  threadCount = max(1, threadCount);
+  OrderedPipeline< string, vector< vector<string> > >(threadCount, threadCount * 2).run(source, work, sink);
+  return sentences;
+}
+
+
+string CorpusReader::getCorpusName() const {
+  string name;
+  for (const auto &path : paths) {
+    name += (name.empty() ? "" : "+") + Utils::getBasename(path);
+  }
+
+  uint64_t hash = Utils::hashText("");
+  for (const auto &filePath : filePaths) {
+    char *fullPath = realpath(filePath.c_str(), nullptr);
+    hash = Utils::hashText((fullPath != nullptr) ? fullPath : filePath, hash);
+    free(fullPath);
+
+    struct stat info;
+    if (stat(filePath.c_str(), &info) == 0) {
+      hash = Utils::hashText(to_string(info.st_size) + ":" + to_string(info.st_mtim.tv_sec) + "." + to_string(info.st_mtim.tv_nsec), hash);
+    }
+    hash = Utils::hashText(string(1, '\0'), hash);
+  }
+
+  char hashDigits[17];
+  snprintf(hashDigits, sizeof(hashDigits), "%016llx", (unsigned long long)hash);
+  return name + "-" + hashDigits;
+}
+
+
+bool CorpusReader::readChunk(string &chunk) {
+  while (true) {
+    if (!file.is_open()) {
+      if (fileIndex >= filePaths.size()) {
+        return false;
+      }
+      file.clear();
+      file.open(filePaths[fileIndex], ios::in | ios::binary);
+      if (!file.is_open()) {
+        printf("ERROR::No file was found %s\n", filePaths[fileIndex].c_str());  // TODO: throw error
+        exit(-1);
+      }
+    }
+
+    // Read up to the byte budget
+    size_t readSize = chunkSize;
+    if (byteLimit > 0) {
+      readSize = (size_t)min((long)readSize, byteLimit - bytesRead);
+    }
+    chunkSize = (chunkSize * 2 < CHUNK_SIZE) ? chunkSize * 2 : CHUNK_SIZE;
+
+    size_t size = carry.size();
+    carry.resize(size + readSize);
+    file.read(&carry[size], readSize);
+    carry.resize(size + file.gcount());
+    bytesRead += file.gcount();
+
+    // Chunks never span files; the rest of a file is its last chunk.
+    // Once the byte budget is spent, the text after the last whole sentence is dropped
+    // (unless the budget ends with the file)
+    size_t cut = carry.size();
+    if (byteLimit > 0 && bytesRead >= byteLimit) {
+      bool isFileEnd = !file || file.peek() == EOF;
+      size_t sentenceEnd = carry.find_last_of(".?!");
+      if (!isFileEnd) {
+        cut = (sentenceEnd == string::npos) ? 0 : sentenceEnd + 1;
+      }
+      carry.resize(cut);
+      file.close();
+      fileIndex = filePaths.size();
+    } else if (file) {
+      cut = findCut(carry);
+    } else {
+      file.close();
+      fileIndex++;
+    }
+    if (cut == string::npos || cut == 0) {
+      continue;
+    }
+
+    chunk = carry.substr(0, cut);
+    carry.erase(0, cut);
+    return true;
+  }
+}
+
+
+size_t CorpusReader::findCut(const string &text) {
+  size_t sentenceEnd = text.find_last_of(".?!");
+  if (sentenceEnd == string::npos) {
+    // No sentence ends in several chunks; cut at a word boundary instead
+    return (text.size() >= 4 * CHUNK_SIZE) ? text.find_last_of(" \t\n") : string::npos;
+  }
+
+  // Prefer the end of the last whole document (the delimiter before its successor's "##<id>")
+  size_t marker = text.rfind("\n##");
+  if (marker != string::npos) {
+    size_t documentEnd = text.find_last_not_of(" \t\r\n", marker);
+    if (documentEnd != string::npos && (text[documentEnd] == '.' || text[documentEnd] == '?' || text[documentEnd] == '!')) {
+      return documentEnd + 1;
+    }
+  }
+  return sentenceEnd + 1;
+}
+
+
+void CorpusReader::addPath(const string &path) {
+  struct stat info;
+  if (stat(path.c_str(), &info) != 0) {
+    printf("ERROR::No file was found %s\n", path.c_str());  // TODO: throw error
+    exit(-1);
+  }
+  if (!S_ISDIR(info.st_mode)) {
+    filePaths.push_back(path);
+    return;
+  }
+
+  DIR *directory = opendir(path.c_str());
+  if (directory == nullptr) {
+    printf("ERROR::Unable to open directory %s\n", path.c_str());
+    exit(-1);
+  }
+  vector<string> names;
+  for (struct dirent *entry = readdir(directory); entry != nullptr; entry = readdir(directory)) {
+    if (entry->d_name[0] != '.') {
+      names.push_back(entry->d_name);
+    }
+  }
+  closedir(directory);
+
+  sort(names.begin(), names.end());
+  for (const auto &name : names) {
+    addPath((path.back() == '/') ? path + name : path + "/" + name);
+  }
+}
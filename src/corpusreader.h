@@ -0,0 +1,116 @@
+#ifndef MARKOV_CORPUSREADER_H
+#define MARKOV_CORPUSREADER_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <atomic>
+
+using namespace std;
+
+
+/**
+ * @brief Reads and tokenizes training text from many files in parallel
+ *
+ * Directories are expanded into the files below them (sorted by path,
+ * hidden entries skipped). Each file is read in chunks cut at the end of
+ * a document (a sentence delimiter before a COCA "##<id>" marker) or else
+ * of a sentence, so chunks tokenize exactly like the whole file. Chunks
+ * are tokenized on worker threads and their sentences handed back in
+ * file and chunk order, so the result does not depend on the thread count.
+ *
+ * Reading stops as soon as a sentence, token or byte budget is reached.
+ * Chunks start small and grow, so a small budget reads and tokenizes
+ * little more than the text it keeps.
+ */
+class CorpusReader {
+public:
+  /**
+   * @param paths training files or directories
+   */
+  CorpusReader(const vector<string> &paths);
+
+  /**
+   * @brief Get the files that are read
+   * @return const vector<string>& file paths in reading order
+   */
+  const vector<string> &getFilePaths() const { return this->filePaths; }
+
+  /**
+   * @brief Set the budgets at which reading stops (0 for no limit)
+   * @param sentenceLimit sentences kept (see Options::getTrainingSentenceLimit())
+   * @param tokenLimit words kept; whole sentences are kept up to the one reaching it
+   * @param byteLimit bytes of text read; text after the last whole sentence within it is dropped, unless the file ends there
+   */
+  void setLimits(int sentenceLimit, long tokenLimit, long byteLimit);
+
+  /**
+   * @brief Get the number of bytes read by the last readSentences()
+   * @return long bytes read (including chunks tokenized after a budget was reached)
+   */
+  long getBytesRead() const { return this->bytesRead; }
+
+  /**
+   * @brief Read and tokenize every file, up to the budgets
+   * @param threadCount threads tokenizing chunks (at least 1)
+   * @return vector<vector<string> > sentences in reading order (see Utils::processTrainingSentences())
+   */
+  vector< vector<string> > readSentences(int threadCount);
+
+  /**
+   * @brief Get the name of the corpus for its cache files
+   *
+   * Names differ for paths sharing a basename, and change with the
+   * files found below a directory or their size or modification time
+   *
+   * @return string basenames of the paths joined by '+', then a hash of the full paths, sizes and modification times of the files
+   */
+  string getCorpusName() const;
+
+private:
+  /// Bytes of text read per chunk
+  static const size_t CHUNK_SIZE = 1 << 22;
+  /// Bytes of text read for the first chunk (chunks double up to CHUNK_SIZE)
+  static const size_t FIRST_CHUNK_SIZE = 1 << 16;
+
+  /// Paths given to the constructor
+  vector<string> paths;
+  vector<string> filePaths;
+
+  int sentenceLimit;
+  long tokenLimit;
+  long byteLimit;
+
+  /// Set by the sink once a sentence or token budget is reached
+  atomic<bool> isBudgetReached;
+  long bytesRead;
+  size_t chunkSize;
+
+  /// File being read (index into filePaths)
+  size_t fileIndex;
+  ifstream file;
+  /// Text read past the last chunk's cut
+  string carry;
+
+  /**
+   * @brief Read the next chunk of text
+   * @param chunk text ending at a document or sentence boundary, or at the end of a file
+   * @return false once every file is read
+   */
+  bool readChunk(string &chunk);
+
+  /**
+   * @brief Find where to cut the text read so far
+   * @param text text read from the current file
+   * @return size_t length of the chunk (npos if no boundary was found)
+   */
+  static size_t findCut(const string &text);
+
+  /**
+   * @brief Add a file, or the files below a directory, to the reading list
+   * @param path file or directory path
+   */
+  void addPath(const string &path);
+};
+
+#endif
@@ -1,4 +1,7 @@
 #include <iostream>
+#include <fstream>
+#include <thread>
+#include <chrono>
 #include <time.h>
 #include <algorithm>
 #include <string>
@@ -12,11 +15,17 @@
 #include "server.h"
 #include "models/markov.h"
 #include "models/mnemonicmarkov.h"
+#include "models/layercache.h"
+#include "taskpool.h"
+#include "random.h"
+#include "scorer.h"
+#include "batchrunner.h"
+#include "repl.h"
+#include "orderedpipeline.h"
 
 
 using namespace std;
 
-// TODO: Implement an interactive mode
 // TODO: Print progress reading in files and processing data
 
 // TODO: Use log probs to prevent underflow for really large sentences
@@ -38,21 +47,156 @@ int runAsCommandLineTool(Options options) {
   // Train non-constrained Markov model
   auto markovModel = MarkovModel(options);
 
-  for (const auto &constraint : options.getConstraints()) {
+  // Constraints share the read-only base model and run concurrently; debug
+  // output is per constraint, so debug runs default to one job at a time
+  int jobCount = options.getJobCount();
+  if (jobCount <= 0) {
+    jobCount = options.getDebug() ? 1 : max(1, (int)thread::hardware_concurrency());
+  }
+  const vector<string> &constraints = options.getConstraints();
+  jobCount = min(jobCount, (int)constraints.size());
+
+  // Seeds are drawn up front in input order so a seeded run does not depend on scheduling
+  vector<uint64_t> seeds;
+  if (options.getUseSeed()) {
+    for (size_t i = 0; i < constraints.size(); i++) {
+      seeds.push_back(Random::makeGenerator()());
+    }
+  }
+
+  size_t nextConstraint = 0;
+  auto source = [&](size_t &index) {
+    if (nextConstraint >= constraints.size()) {
+      return false;
+    }
+    index = nextConstraint++;
+    return true;
+  };
+
+  auto work = [&](size_t &index) {
+    const string &constraint = constraints[index];
     Console::debugPrint("%-35s: %s\n", "Constraint", constraint.c_str());
 
     auto model = MnemonicMarkovModel(markovModel, Utils::cleanConstraint(constraint), options);
+    if (!seeds.empty()) {
+      model.setSeed(seeds[index]);
+    }
     model.printDebugInfo(options);
-    auto generatedSentences = model.generateSentences(options);
 
-    // Print to standard output
-    for (const auto &sentence : generatedSentences) {
+    string output;
+    for (const auto &sentence : model.generateSentences(options)) {
       for (const string &word : sentence) {
-        printf("%s ", word.c_str());
+        output += word;
+        output += " ";
       }
-      printf("\n");
+      output += "\n";
     }
+    return output;
+  };
+
+  // Print to standard output in input order as each constraint completes
+  auto sink = [](string &output) {
+    fwrite(output.data(), 1, output.size(), stdout);
+    fflush(stdout);
+  };
+
+  OrderedPipeline<size_t, string>(jobCount, jobCount * 2).run(source, work, sink);
+  return 0;
+}
+
+
+int runAsScoringTool(Options options) {
+  if (options.getTrainingFilePath().empty()) {
+    printf("Training text is needed.\n");
+    Console::printHelp();
+    return 0;
+  }
+
+  ifstream scoreFile(options.getScoreFilePath());
+  if (!scoreFile) {
+    printf("ERROR::Could not open %s\n", options.getScoreFilePath().c_str());
+    return 1;
   }
+
+  auto markovModel = MarkovModel(options);
+
+  // Per-sentence scores go to standard output, the summary to standard error
+  time_t startTime = clock();
+  auto wallStartTime = chrono::steady_clock::now();
+  Scorer scorer(markovModel);
+  ScoreSummary summary = scorer.scoreStream(scoreFile, stdout);
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - wallStartTime).count();
+
+  fprintf(stderr, "%-35s: %ld\n", "Sentences", summary.sentenceCount);
+  fprintf(stderr, "%-35s: %ld\n", "Unscored Sentences (zero prob)", summary.unscoredCount);
+  fprintf(stderr, "%-35s: %ld\n", "Scored Words", summary.wordCount);
+  fprintf(stderr, "%-35s: %f\n", "Total Log Prob", summary.logProb);
+  // Unscored sentences are left out of the perplexity, so their share is shown with it
+  fprintf(stderr, "%-35s: %f\n", "Perplexity (scored sentences)", summary.getPerplexity());
+  fprintf(stderr, "%-35s: %.2f%% of sentences, %.2f%% of words\n", "Left Out Of Perplexity",
+          (summary.sentenceCount > 0) ? 100.0 * summary.unscoredCount / summary.sentenceCount : 0.0,
+          100.0 * summary.getUnscoredWordShare());
+  fprintf(stderr, "%-35s: %f (cpu %f)\n", "Elapsed Scoring Time", elapsed, (float)(clock() - startTime) / CLOCKS_PER_SEC);
+  fprintf(stderr, "%-35s: %.0f sentences/s\n", "Throughput", (elapsed > 0.0) ? summary.sentenceCount / elapsed : 0.0);
+  return 0;
+}
+
+
+int runAsBatchTool(Options options) {
+  if (options.getTrainingFilePath().empty()) {
+    printf("Training text is needed.\n");
+    Console::printHelp();
+    return 0;
+  }
+
+  ifstream batchFile;
+  if (options.getBatchFilePath() != "-") {
+    batchFile.open(options.getBatchFilePath());
+    if (!batchFile) {
+      printf("ERROR::Could not open %s\n", options.getBatchFilePath().c_str());
+      return 1;
+    }
+  }
+  istream &constraints = (options.getBatchFilePath() == "-") ? cin : batchFile;
+
+  auto markovModel = MarkovModel(options);
+
+  int jobCount = options.getJobCount();
+  if (jobCount <= 0) {
+    jobCount = max(1, (int)thread::hardware_concurrency());
+  }
+
+  // Records go to standard output, the summary to standard error
+  auto wallStartTime = chrono::steady_clock::now();
+  BatchRunner runner(markovModel, options);
+  BatchSummary summary = runner.runStream(constraints, stdout, jobCount);
+  double elapsed = chrono::duration<double>(chrono::steady_clock::now() - wallStartTime).count();
+
+  fprintf(stderr, "%-35s: %ld\n", "Constraints", summary.constraintCount);
+  fprintf(stderr, "%-35s: %ld\n", "Constraints Without Sentences", summary.emptyCount);
+  fprintf(stderr, "%-35s: %ld\n", "Sentences", summary.sentenceCount);
+  fprintf(stderr, "%-35s: %f\n", "Total Compile Time", summary.compileTime);
+  fprintf(stderr, "%-35s: %f\n", "Total Sample Time", summary.sampleTime);
+  fprintf(stderr, "%-35s: %f\n", "Elapsed Batch Time", elapsed);
+  fprintf(stderr, "%-35s: %.0f constraints/s\n", "Throughput", (elapsed > 0.0) ? summary.constraintCount / elapsed : 0.0);
+  return 0;
+}
+
+
+int runInteractive(Options options) {
+  if (options.getTrainingFilePath().empty()) {
+    printf("Training text is needed.\n");
+    Console::printHelp();
+    return 0;
+  }
+
+  // Train (or load) once; every constraint typed afterwards reuses the model
+  auto wallStartTime = chrono::steady_clock::now();
+  auto markovModel = MarkovModel(options);
+  printf("%-35s: %f\n", "Model Ready In", chrono::duration<double>(chrono::steady_clock::now() - wallStartTime).count());
+
+  Repl repl(markovModel, options);
+  repl.run(cin);
   return 0;
 }
 
@@ -68,7 +212,27 @@ int main(int argc, char *argv[]) {
     return 0;
   }
 
-  if (!options.getShouldRunAsServer()) {
+  LayerCache::getInstance().setCapacity((size_t)max(0, options.getLayerCacheSize()) * 1024 * 1024);
+  // Bulk scoring defaults to every core; compiling defaults to serial
+  int threadCount = options.getCompileThreads();
+  if (threadCount <= 0) {
+    threadCount = options.getScoreFilePath().empty() ? 1 : max(1, (int)thread::hardware_concurrency());
+  }
+  TaskPool::getInstance().setThreadCount(threadCount);
+  if (options.getUseSeed()) {
+    Random::setSeed(options.getSeed());
+  }
+
+  if (!options.getScoreFilePath().empty()) {
+    return runAsScoringTool(options);
+  }
+  else if (options.getShouldRunInteractive()) {
+    return runInteractive(options);
+  }
+  else if (!options.getBatchFilePath().empty()) {
+    return runAsBatchTool(options);
+  }
+  else if (!options.getShouldRunAsServer()) {
     return runAsCommandLineTool(options);
   }
   else {
@@ -0,0 +1,445 @@
+#include "compilesession.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "kbestpaths.h"
+#include "multinomial.h"
+#include "distinctpaths.h"
+
+
+CompileSession::CompileSession(const MarkovModel &model, shared_ptr<ConstrainedMarkovModel> rules) {
+  this->baseModel = &model;
+  this->rules = rules;
+  this->endCumulativeValid = false;
+
+  int vocabularySize = (int)model.getVocabulary().size();
+  nodeIndices.assign(model.getStateCount(), -1);
+
+  // Word frequencies are used as the prior probabilities
+  startWeights.assign(vocabularySize, 0.0);
+  for (int wordId = 0; wordId < vocabularySize; wordId++) {
+    startWeights[wordId] = model.getWordFrequency(wordId);
+  }
+
+  // Initialize random
+  randGenerator = Random::makeGenerator();
+}
+
+
+void CompileSession::appendConstraint(const string &token) {
+  constraint.push_back(token);
+
+  SessionLayer layer;
+  layer.constraintLayer = rules->buildConstraintLayer(*baseModel, constraint, (int)constraint.size() - 1);
+  linkLayer(layer);
+
+  layers.push_back(move(layer));
+  endCumulativeValid = false;
+}
+
+
+void CompileSession::removeConstraint() {
+  if (layers.empty()) {
+    return;
+  }
+  constraint.pop_back();
+  layers.pop_back();
+  endCumulativeValid = false;
+}
+
+
+void CompileSession::linkLayer(SessionLayer &layer) {
+  const unsigned __int128 maxCount = ~(unsigned __int128)0;
+  int position = (int)layers.size();
+  const vector<int> *candidateIds = &layer.constraintLayer->nodes;
+  vector<int> allStateIds;
+  if (layer.constraintLayer->isWildcard) {
+    for (int stateId = baseModel->getPositionStatesBegin(position); stateId < baseModel->getPositionStatesEnd(position); stateId++) {
+      allStateIds.push_back(stateId);
+    }
+    candidateIds = &allStateIds;
+  }
+  const vector<int> &candidates = *candidateIds;
+  const auto &baseTargets = baseModel->getTransitionTargets();
+  int candidateCount = (int)candidates.size();
+
+  for (int k = 0; k < candidateCount; k++) {
+    nodeIndices[candidates[k]] = k;
+  }
+
+  // Gather incoming edges per candidate; the first layer is entered from START
+  vector<int> offsets(candidateCount + 1, 0);
+  vector<int> sources;
+  vector<double> probs;
+  if (layers.empty()) {
+    for (int k = 0; k < candidateCount; k++) {
+      offsets[k+1] = offsets[k] + (startWeights[baseModel->getStateWord(candidates[k])] > 0.0 ? 1 : 0);
+    }
+    sources.assign(offsets[candidateCount], 0);
+    probs.resize(offsets[candidateCount]);
+    for (int k = 0; k < candidateCount; k++) {
+      if (offsets[k+1] > offsets[k]) {
+        probs[offsets[k]] = startWeights[baseModel->getStateWord(candidates[k])];
+      }
+    }
+  } else {
+    const SessionLayer &prev = layers.back();
+    for (int a = 0; a < (int)prev.nodes.size(); a++) {
+      int wordId = prev.nodes[a];
+      for (int e = baseModel->getTransitionBegin(wordId); e < baseModel->getTransitionEnd(wordId); e++) {
+        int k = nodeIndices[baseTargets[e]];
+        if (k >= 0) {
+          offsets[k+1]++;
+        }
+      }
+    }
+    for (int k = 0; k < candidateCount; k++) {
+      offsets[k+1] += offsets[k];
+    }
+    sources.resize(offsets[candidateCount]);
+    probs.resize(offsets[candidateCount]);
+    vector<int> cursor(offsets.begin(), offsets.end() - 1);
+    for (int a = 0; a < (int)prev.nodes.size(); a++) {
+      int wordId = prev.nodes[a];
+      for (int e = baseModel->getTransitionBegin(wordId); e < baseModel->getTransitionEnd(wordId); e++) {
+        int k = nodeIndices[baseTargets[e]];
+        if (k >= 0) {
+          sources[cursor[k]] = a;
+          probs[cursor[k]++] = baseModel->getTransitionProbability(wordId, e);
+        }
+      }
+    }
+  }
+
+  for (int k = 0; k < candidateCount; k++) {
+    nodeIndices[candidates[k]] = -1;
+  }
+
+  // Keep only candidates reachable from START and accumulate forward sums and counts
+  const SessionLayer *prev = layers.empty() ? nullptr : &layers.back();
+  double maxForwardSum = 0.0;
+  double maxScaledCount = 0.0;
+  layer.inOffsets.push_back(0);
+  for (int k = 0; k < candidateCount; k++) {
+    if (offsets[k+1] == offsets[k]) {
+      layer.unreachableNodes.push_back(baseModel->getStateWord(candidates[k]));
+      continue;
+    }
+
+    double forwardSum = 0.0;
+    unsigned __int128 pathCount = 0;
+    double scaledCount = 0.0;
+    for (int e = offsets[k]; e < offsets[k+1]; e++) {
+      int a = sources[e];
+      unsigned __int128 count = prev ? prev->pathCounts[a] : 1;
+      forwardSum += (prev ? prev->forwardSums[a] : 1.0) * probs[e];
+      pathCount = (pathCount > maxCount - count) ? maxCount : pathCount + count;
+      scaledCount += prev ? prev->scaledCounts[a] : 1.0;
+      layer.inSources.push_back(a);
+      layer.inProbs.push_back(probs[e]);
+    }
+    layer.nodes.push_back(candidates[k]);
+    layer.inOffsets.push_back((int)layer.inSources.size());
+    layer.forwardSums.push_back(forwardSum);
+    layer.pathCounts.push_back(pathCount);
+    layer.scaledCounts.push_back(scaledCount);
+    maxForwardSum = max(maxForwardSum, forwardSum);
+    maxScaledCount = max(maxScaledCount, scaledCount);
+  }
+
+  // Rescale per layer so long sessions neither underflow nor overflow
+  if (maxForwardSum > 0.0) {
+    for (double &sum : layer.forwardSums) {
+      sum /= maxForwardSum;
+    }
+  }
+  layer.log10Scale = prev ? prev->log10Scale : 0.0;
+  if (maxScaledCount > 0.0) {
+    for (double &count : layer.scaledCounts) {
+      count /= maxScaledCount;
+    }
+    layer.log10Scale += log10(maxScaledCount);
+  }
+}
+
+
+const vector<string> &CompileSession::getConstraint() const {
+  return constraint;
+}
+
+
+int CompileSession::getSentenceLength() const {
+  return (int)layers.size();
+}
+
+
+void CompileSession::buildEndCumulative() {
+  const SessionLayer &last = layers.back();
+
+  // A path ending in a node is weighted by the node's outgoing row sum,
+  // as the last layer of the trained model is (1, or 0 for a row without transitions)
+  endCumulative.resize(last.nodes.size());
+  double total = 0.0;
+  for (int k = 0; k < (int)last.nodes.size(); k++) {
+    int wordId = last.nodes[k];
+    total += (baseModel->getRowTotal(wordId) > 0) ? last.forwardSums[k] : 0.0;
+    endCumulative[k] = total;
+  }
+  endCumulativeValid = true;
+}
+
+
+int CompileSession::sampleCumulative(const double *cumulative, int size) {
+  double randomValue = randGenerator.nextDouble() * cumulative[size - 1];
+  int index = (int)(upper_bound(cumulative, cumulative + size, randomValue) - cumulative);
+  return min(index, size - 1);
+}
+
+
+vector<string> CompileSession::generateSentence() {
+  vector<string> sentence(layers.size(), "");
+  if (layers.empty()) {
+    return sentence;
+  }
+  if (!endCumulativeValid) {
+    buildEndCumulative();
+  }
+  if (endCumulative.empty() || endCumulative.back() <= 0.0) {
+    return sentence;
+  }
+
+  const auto &vocabulary = baseModel->getVocabulary();
+  vector<double> edgeCumulative;
+
+  // Walk backward, choosing each predecessor by its forward sum times the edge probability
+  int node = sampleCumulative(endCumulative.data(), (int)endCumulative.size());
+  for (int i = (int)layers.size() - 1; i >= 0; i--) {
+    const SessionLayer &layer = layers[i];
+    sentence[i] = vocabulary[baseModel->getStateWord(layer.nodes[node])];
+    if (i == 0) {
+      break;
+    }
+
+    const SessionLayer &prev = layers[i-1];
+    int begin = layer.inOffsets[node];
+    int end = layer.inOffsets[node+1];
+    edgeCumulative.resize(end - begin);
+    double total = 0.0;
+    for (int e = begin; e < end; e++) {
+      total += prev.forwardSums[layer.inSources[e]] * layer.inProbs[e];
+      edgeCumulative[e - begin] = total;
+    }
+    node = layer.inSources[begin + sampleCumulative(edgeCumulative.data(), end - begin)];
+  }
+
+  return sentence;
+}
+
+
+vector<vector<string> > CompileSession::generateSentences(int count) {
+  vector<vector<string> > sentences;
+  if (count <= 0) {
+    return sentences;
+  }
+  if (!layers.empty() && !endCumulativeValid) {
+    buildEndCumulative();
+  }
+  if (layers.empty() || endCumulative.empty() || endCumulative.back() <= 0.0) {
+    return vector<vector<string> >(count, vector<string>(layers.size(), ""));
+  }
+
+  int nodeCount = (int)endCumulative.size();
+  vector<double> endWeights(nodeCount);
+  for (int k = 0; k < nodeCount; k++) {
+    endWeights[k] = endCumulative[k] - ((k > 0) ? endCumulative[k-1] : 0.0);
+  }
+  vector<int> counts(nodeCount);
+  splitMultinomial(count, endWeights.data(), nodeCount, randGenerator, counts.data());
+
+  sentences.reserve(count);
+  vector<string> sentence(layers.size());
+  for (int k = 0; k < nodeCount; k++) {
+    if (counts[k] > 0) {
+      sampleSentences((int)layers.size() - 1, k, counts[k], sentence, sentences);
+    }
+  }
+
+  // Sentences come out grouped by suffix
+  shuffle(sentences.begin(), sentences.end(), randGenerator);
+  return sentences;
+}
+
+
+void CompileSession::sampleSentences(int layerIndex, int nodeIndex, int count, vector<string> &sentence, vector<vector<string> > &sentences) {
+  const SessionLayer &layer = layers[layerIndex];
+  sentence[layerIndex] = baseModel->getVocabulary()[baseModel->getStateWord(layer.nodes[nodeIndex])];
+  if (layerIndex == 0) {
+    sentences.insert(sentences.end(), count, sentence);
+    return;
+  }
+
+  // Predecessors are weighted by their forward sum times the edge probability
+  const SessionLayer &prev = layers[layerIndex - 1];
+  int begin = layer.inOffsets[nodeIndex];
+  int end = layer.inOffsets[nodeIndex+1];
+  vector<double> weights(end - begin);
+  for (int e = begin; e < end; e++) {
+    weights[e - begin] = prev.forwardSums[layer.inSources[e]] * layer.inProbs[e];
+  }
+  vector<int> counts(end - begin);
+  splitMultinomial(count, weights.data(), end - begin, randGenerator, counts.data());
+  for (int e = begin; e < end; e++) {
+    if (counts[e - begin] > 0) {
+      sampleSentences(layerIndex - 1, layer.inSources[e], counts[e - begin], sentence, sentences);
+    }
+  }
+}
+
+
+vector<vector<string> > CompileSession::sampleDistinctSentences(int count) {
+  // Every solution is returned when there are too few to choose from
+  SolutionCount solutionCount = getTotalSolutionCount();
+  if (solutionCount.isExact && solutionCount.exact <= (unsigned __int128)max(count, 0)) {
+    return generateBestSentences((int)solutionCount.exact);
+  }
+  if (!endCumulativeValid) {
+    buildEndCumulative();
+  }
+
+  // Walk from the last layer back, as generateSentence() does
+  int layerCount = (int)layers.size();
+  auto edges = [&](int decodeIndex, int nodeIndex, auto g) {
+    if (decodeIndex < 0) {
+      for (int k = 0; k < (int)endCumulative.size(); k++) {
+        g(k, endCumulative[k] - ((k > 0) ? endCumulative[k-1] : 0.0));
+      }
+      return;
+    }
+    const SessionLayer &layer = layers[layerCount - 1 - decodeIndex];
+    const SessionLayer &prev = layers[layerCount - 2 - decodeIndex];
+    for (int e = layer.inOffsets[nodeIndex]; e < layer.inOffsets[nodeIndex+1]; e++) {
+      g(layer.inSources[e], prev.forwardSums[layer.inSources[e]] * layer.inProbs[e]);
+    }
+  };
+  vector<vector<int> > paths = samplePathsWithoutReplacement(layerCount, edges, count, randGenerator);
+
+  const auto &vocabulary = baseModel->getVocabulary();
+  vector<vector<string> > sentences;
+  for (const auto &path : paths) {
+    vector<string> sentence(layerCount);
+    for (int i = 0; i < layerCount; i++) {
+      sentence[i] = vocabulary[baseModel->getStateWord(layers[i].nodes[path[layerCount - 1 - i]])];
+    }
+    sentences.push_back(sentence);
+  }
+  return sentences;
+}
+
+
+vector<vector<string> > CompileSession::generateBestSentences(int count) {
+  vector<vector<string> > sentences;
+  int layerCount = (int)layers.size();
+  if (layerCount == 0) {
+    return sentences;
+  }
+
+  // Decode the incoming edges from the last layer back to a virtual START node;
+  // a path ending in a node is weighted by its outgoing row sum (see buildEndCumulative())
+  vector<int> layerSizes;
+  for (int i = layerCount - 1; i >= 0; i--) {
+    layerSizes.push_back((int)layers[i].nodes.size());
+  }
+  layerSizes.push_back(1);
+
+  const SessionLayer &last = layers.back();
+  vector<double> startScores(last.nodes.size());
+  for (int k = 0; k < (int)last.nodes.size(); k++) {
+    int stateId = last.nodes[k];
+    startScores[k] = (baseModel->getRowTotal(stateId) > 0) ? 0.0 : -INFINITY;  // log of the row sum
+  }
+  auto endScore = [](int nodeIndex) {
+    return 0.0;
+  };
+  auto logEdges = [&](int decodeIndex, int nodeIndex, auto g) {
+    const SessionLayer &layer = layers[layerCount - 1 - decodeIndex];
+    bool isFirst = decodeIndex == layerCount - 1;
+    for (int e = layer.inOffsets[nodeIndex]; e < layer.inOffsets[nodeIndex+1]; e++) {
+      if (layer.inProbs[e] > 0.0) {
+        g(isFirst ? 0 : layer.inSources[e], log(layer.inProbs[e]));
+      }
+    }
+  };
+  vector<ScoredPath> paths = findBestPaths(layerSizes, startScores, endScore, logEdges, count);
+
+  const auto &vocabulary = baseModel->getVocabulary();
+  for (const auto &path : paths) {
+    vector<string> sentence(layerCount);
+    for (int i = 0; i < layerCount; i++) {
+      sentence[i] = vocabulary[baseModel->getStateWord(layers[i].nodes[path.nodes[layerCount - 1 - i]])];
+    }
+    sentences.push_back(sentence);
+  }
+  return sentences;
+}
+
+
+SolutionCount CompileSession::getTotalSolutionCount() const {
+  const unsigned __int128 maxCount = ~(unsigned __int128)0;
+
+  SolutionCount solutionCount;
+  solutionCount.exact = 0;
+  solutionCount.isExact = true;
+  solutionCount.log10Count = -INFINITY;
+  if (layers.empty()) {
+    return solutionCount;
+  }
+
+  const SessionLayer &last = layers.back();
+  double scaledCount = 0.0;
+  for (int k = 0; k < (int)last.nodes.size(); k++) {
+    unsigned __int128 count = last.pathCounts[k];
+    solutionCount.exact = (solutionCount.exact > maxCount - count) ? maxCount : solutionCount.exact + count;
+    scaledCount += last.scaledCounts[k];
+  }
+  solutionCount.isExact = solutionCount.exact != maxCount;
+  if (scaledCount > 0.0) {
+    solutionCount.log10Count = log10(scaledCount) + last.log10Scale;
+  }
+  return solutionCount;
+}
+
+
+string CompileSession::sampleRemovedNodeByConstraint(int layerIndex) {
+  return sampleRemovedNodesByConstraint(layerIndex, 1)[0];
+}
+
+
+string CompileSession::sampleUnreachableNode(int layerIndex) {
+  return sampleUnreachableNodes(layerIndex, 1)[0];
+}
+
+
+vector<string> CompileSession::sampleRemovedNodesByConstraint(int layerIndex, int count) {
+  return rules->sampleRemovedNodesByConstraint(*layers[layerIndex].constraintLayer, count);
+}
+
+
+vector<string> CompileSession::sampleUnreachableNodes(int layerIndex, int count) {
+  return sampleRemovedNodes(layers[layerIndex].unreachableNodes, count);
+}
+
+
+vector<string> CompileSession::sampleRemovedNodes(const vector<int> &removed, int count) {
+  if (removed.size() == 0) {
+    return vector<string>(count, "");
+  }
+  vector<double> randVals(count);
+  randGenerator.fillDoubles(randVals.data(), count);
+  vector<string> words(count);
+  int size = (int)removed.size();
+  for (int i = 0; i < count; i++) {
+    words[i] = baseModel->getVocabulary()[removed[min((int)(randVals[i] * size), size - 1)]];
+  }
+  return words;
+}
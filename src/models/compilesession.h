@@ -0,0 +1,207 @@
+#ifndef COMPILE_SESSION_H
+#define COMPILE_SESSION_H
+
+#include <string>
+#include <vector>
+#include <random>
+#include <memory>
+
+#include "markov.h"
+#include "constrainedmarkov.h"
+#include "layer.h"
+
+using namespace std;
+
+
+/**
+ * @brief Constrained layered graph that grows one constraint at a time
+ *
+ * Keeps the graph in forward form (incoming edges, forward sums and
+ * forward path counts), so appending or removing the last constraint
+ * only touches that layer. Sentences are sampled backward from the
+ * last layer, which yields the same distribution as a fully trained
+ * ConstrainedMarkovModel for the same constraint.
+ */
+class CompileSession {
+public:
+
+  /**
+   * @brief Start an empty session
+   *
+   * @param model trained markov model to use (must outlive the session)
+   * @param rules constrained model providing the constraint rules
+   */
+  CompileSession(const MarkovModel &model, shared_ptr<ConstrainedMarkovModel> rules);
+  ~CompileSession() {};
+
+  /**
+   * @brief Append one constraint position as a new last layer
+   *
+   * @param token constraint of the new position
+   */
+  void appendConstraint(const string &token);
+
+  /**
+   * @brief Remove the last constraint position (no-op when empty)
+   */
+  void removeConstraint();
+
+  /**
+   * @brief Reseed the random generator (for reproducible sampling)
+   *
+   * @param seed seed value
+   */
+  void setSeed(uint64_t seed) { randGenerator.seed(seed); }
+
+  /**
+   * @brief Get the current constraint sequence
+   *
+   * @return const vector<string>& constraint
+   */
+  const vector<string> &getConstraint() const;
+
+  /**
+   * @brief Get the Sentence Length object
+   *
+   * @return int number of constraint positions
+   */
+  int getSentenceLength() const;
+
+  /**
+   * @brief Generates a sentence
+   *
+   * @return vector<string> words, empty strings when no sentence exists
+   */
+  vector<string> generateSentence();
+
+  /**
+   * @brief Generates sentences
+   *
+   * Draws all the sentences at once by splitting the count among the
+   * incoming edges of each node, from the last layer back (see
+   * splitMultinomial()), then shuffles them
+   *
+   * @param count number of sentences
+   * @return vector<vector<string> > sentences
+   */
+  vector<vector<string> > generateSentences(int count);
+
+  /**
+   * @brief Generates distinct sentences, sampled without replacement
+   *
+   * Samples backward from the last layer (see samplePathsWithoutReplacement()).
+   * If the session has no more solutions than requested, all of them
+   * are returned, most probable first.
+   *
+   * @param count number of sentences
+   * @return vector<vector<string> > distinct sentences
+   */
+  vector<vector<string> > sampleDistinctSentences(int count);
+
+  /**
+   * @brief Generates the most probable sentences
+   * 
+   * Decodes the graph backward from the last layer (see findBestPaths())
+   * 
+   * @param count number of sentences
+   * @return vector<vector<string> > sentences by decreasing probability
+   * (fewer if the session has fewer solutions)
+   */
+  vector<vector<string> > generateBestSentences(int count);
+
+  /**
+   * @brief Count the sentences the session can currently generate
+   *
+   * @return SolutionCount exact count (or estimate) and its log10
+   */
+  SolutionCount getTotalSolutionCount() const;
+
+  /**
+   * @brief Sample a word removed by the constraint at a position
+   *
+   * @param layerIndex constraint position
+   * @return string removed word or "" if none
+   */
+  string sampleRemovedNodeByConstraint(int layerIndex);
+
+  /**
+   * @brief Sample a word satisfying the constraint at a position but
+   * unreachable from the previous positions
+   *
+   * @param layerIndex constraint position
+   * @return string unreachable word or "" if none
+   */
+  string sampleUnreachableNode(int layerIndex);
+
+  /**
+   * @brief Sample words removed by the constraint at a position
+   *
+   * @param layerIndex constraint position
+   * @param count number of samples
+   * @return vector<string> removed words ("" if none)
+   */
+  vector<string> sampleRemovedNodesByConstraint(int layerIndex, int count);
+
+  /**
+   * @brief Sample words satisfying the constraint at a position but
+   * unreachable from the previous positions
+   *
+   * Unlike the one-shot model's words removed by arc consistency, which
+   * cannot reach the later positions, these cannot be reached from START
+   *
+   * @param layerIndex constraint position
+   * @param count number of samples
+   * @return vector<string> unreachable words ("" if none)
+   */
+  vector<string> sampleUnreachableNodes(int layerIndex, int count);
+
+private:
+  /**
+   * @brief Forward form of one constraint position
+   */
+  struct SessionLayer {
+    /// Nodes kept by the constraint and removed-node bookkeeping
+    shared_ptr<Layer> constraintLayer;
+    /// Sorted state IDs reachable from START
+    vector<int> nodes;
+    /// CSR of incoming edges, sources are node indices in the previous layer
+    vector<int> inOffsets;
+    vector<int> inSources;
+    vector<double> inProbs;
+    /// Forward probability sums, rescaled so the largest is 1
+    vector<double> forwardSums;
+    /// Forward path counts (saturating) and their rescaled floating counterpart
+    vector<unsigned __int128> pathCounts;
+    vector<double> scaledCounts;
+    double log10Scale = 0.0;
+    /// Constraint nodes unreachable from START
+    vector<int> unreachableNodes;
+  };
+
+  const MarkovModel *baseModel;
+  shared_ptr<ConstrainedMarkovModel> rules;
+  vector<string> constraint;
+  vector<SessionLayer> layers;
+
+  /// Unigram frequency by vocab ID, the prior of the first position
+  vector<double> startWeights;
+  /// State ID -> node index in the layer being appended (-1 if absent)
+  vector<int> nodeIndices;
+  /// Cumulative end weights of the last layer (rebuilt lazily)
+  vector<double> endCumulative;
+  bool endCumulativeValid;
+
+  RandomGenerator randGenerator;
+
+  void linkLayer(SessionLayer &layer);
+
+  void buildEndCumulative();
+
+  int sampleCumulative(const double *cumulative, int size);
+
+  void sampleSentences(int layerIndex, int nodeIndex, int count, vector<string> &sentence, vector<vector<string> > &sentences);
+
+  vector<string> sampleRemovedNodes(const vector<int> &removed, int count);
+};
+
+#endif
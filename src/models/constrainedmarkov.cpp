@@ -3,12 +3,21 @@
 #include <vector>
 #include <unordered_map>
 #include <random>
+#include <algorithm>
 #include <time.h>
+#include <math.h>
+#include <typeinfo>
 
 #include "../utils.h"
 #include "../console.h"
 #include "../debug.h"
 #include "constrainedmarkov.h"
+#include "normalizekernel.h"
+#include "layercache.h"
+#include "kbestpaths.h"
+#include "multinomial.h"
+#include "distinctpaths.h"
+#include "../taskpool.h"
 #include "markov.h"
 
 using namespace std;
@@ -21,54 +30,193 @@ using namespace std;
 
 // TODO: Templates for non-string use cases
 
+/// Rows (or states) per task; smaller layers are processed serially
+static const int ROW_GRAIN = 2048;
+
 ConstrainedMarkovModel::ConstrainedMarkovModel() {
+  this->baseModel = nullptr;
+
   // Initialize random
-  random_device rd;
-  randGenerator = mt19937(rd());
-  randDistribution = uniform_real_distribution<double>(0.0, 1.0);
+  randGenerator = Random::makeGenerator();
 }
 
-void ConstrainedMarkovModel::train(MarkovModel model, vector<string> constraint) {
+template <class F>
+void ConstrainedMarkovModel::forEachEdge(int layerIndex, int nodeIndex, F f) const {
+  const Layer &layer = *layers[layerIndex];
+
+  if (!layer.edgeOffsets.empty()) {
+    for (int e = layer.edgeOffsets[nodeIndex]; e < layer.edgeOffsets[nodeIndex+1]; e++) {
+      if (f(layer.edgeTargets[e], layer.edgeProbs[e])) {
+        return;
+      }
+    }
+    return;
+  }
+
+  // Implicit edges follow the base model row, restricted to live nodes of the next layer
+  const Layer &nextLayer = *layers[layerIndex + 1];
+  const auto &targets = baseModel->getTransitionTargets();
+  const auto &counts = baseModel->getTransitionCounts();
+  int wordId = layer.nodeId(nodeIndex);
+  double scale = (layer.sums[nodeIndex] > 0.0) ? 1.0 / (layer.sums[nodeIndex] * baseModel->getRowTotal(wordId)) : 0.0;
+
+  for (int e = baseModel->getTransitionBegin(wordId); e < baseModel->getTransitionEnd(wordId); e++) {
+    int target = nextLayer.indexOf(targets[e]);
+    if (target >= 0 && f(target, counts[e] * nextLayer.sums[target] * scale)) {
+      return;
+    }
+  }
+}
+
+
+void ConstrainedMarkovModel::train(const MarkovModel &model, vector<string> constraint) {
 
   time_t startTime;
 
   // Clear model data structures
-  transitionMatrices.clear();
-  transitionProbs.clear();
+  layers.clear();
 
+  this->baseModel = &model;
   this->markovOrder = model.getMarkovOrder();
-  this->trainingSequences = model.getTrainingSequences();
-  this->transitionProbs = model.getProbabilityMatrix();
   this->sentenceLength = (int)constraint.size();
 
-  // copy matrices for each word (note that START is added later, see addStartTransition())
-  startTime = clock();
-  for (int i = 0; i < ceil(((double)sentenceLength) / markovOrder); i++) {
-    transitionMatrices.push_back(transitionProbs);
-  }
-  Console::debugPrint("%-35s: %f\n", "Elapsed Time Copying Matrices", (float)(clock() - startTime)/CLOCKS_PER_SEC);
+  // one matrix for each word (note that START is added later, see addStartTransition())
+  // Higher orders keep one layer per word, with context states as nodes
+  layers.resize(sentenceLength);
 
-  initRemovedNodeArrays(transitionMatrices.size());
+  // Reuse the layers of the longest cached constraint suffix
+  startTime = clock();
+  int headSize = reuseCachedLayers(constraint);
+  Console::debugPrint("%-35s: %f\n", "Elapsed Time Reading Layer Cache", (float)(clock() - startTime)/CLOCKS_PER_SEC);
+  Console::debugPrint("%-35s: %d / %d\n", "Reused Cached Layers", (int)layers.size() - headSize, (int)layers.size());
 
-  // Apply constraint by removing nodes that violate the constraint
+  // Apply constraint by materializing only the nodes that satisfy the constraint
   startTime = clock();
-  applyConstraints(constraint);
+  applyConstraints(constraint, headSize);
   Console::debugPrint("%-35s: %f\n", "Elapsed Time Applying Constraints", (float)(clock() - startTime)/CLOCKS_PER_SEC);
 
   // Enforce arc-consistency
   startTime = clock();
-  removeDeadNodes();
+  removeDeadNodes(headSize);
   Console::debugPrint("%-35s: %f\n", "Elapsed Time Removing Nodes", (float)(clock() - startTime)/CLOCKS_PER_SEC);
 
+  // Normalize as described in Pachet's paper
+  startTime = clock();
+  normalize(headSize);
+  Console::debugPrint("%-35s: %f\n", "Elapsed Time Normalizing", (float)(clock() - startTime)/CLOCKS_PER_SEC);
+
+  cacheLayers(constraint, headSize);
+
   // Add in start transition matrices (<<START>> -> "foo")
   startTime = clock();
   addStartTransition();
+  normalize(1);
   Console::debugPrint("%-35s: %f\n", "Elapsed Time Adding Start Matrix", (float)(clock() - startTime)/CLOCKS_PER_SEC);
+}
 
-  // Normalize as described in Pachet's paper
-  startTime = clock();
-  normalize();
-  Console::debugPrint("%-35s: %f\n", "Elapsed Time Normalizing", (float)(clock() - startTime)/CLOCKS_PER_SEC);
+
+shared_ptr<Layer> ConstrainedMarkovModel::buildConstraintLayer(const MarkovModel &model, const vector<string> &constraint, int layerIndex) {
+  this->baseModel = &model;
+  this->markovOrder = model.getMarkovOrder();
+
+  layers.assign(layerIndex + 1, nullptr);
+  applyConstraint(constraint, layerIndex);
+  if (!layers[layerIndex]) {
+    makeWildcardLayer(layerIndex);
+  }
+
+  shared_ptr<Layer> layer = layers[layerIndex];
+  layers.clear();
+  return layer;
+}
+
+
+void ConstrainedMarkovModel::applyConstraints(const vector<string> &constraint, int layerEnd) {
+  int wordCount = (int)baseModel->getVocabulary().size() - baseModel->getFirstWordId();
+
+  int removedNodesCount = 0;
+  int totalNodesCount = 0;
+
+  // Layers are filtered independently of each other
+  TaskPool::getInstance().parallelFor(0, layerEnd, 1, [&](int chunkBegin, int chunkEnd) {
+    for (int i = chunkBegin; i < chunkEnd; i++) {
+      applyConstraint(constraint, i);
+      if (!layers[i]) {
+        makeWildcardLayer(i);
+      }
+    }
+  });
+
+  for (int i = 0; i < layerEnd; i++) {
+    removedNodesCount += layers[i]->removedByConstraintCount;
+    totalNodesCount += wordCount;
+  }
+
+  Console::debugPrint("%-35s: %d / %d\n", "Removed nodes", removedNodesCount, totalNodesCount);
+}
+
+
+int ConstrainedMarkovModel::reuseCachedLayers(const vector<string> &constraint) {
+  LayerCache &cache = LayerCache::getInstance();
+  if (cache.getCapacity() == 0) {
+    return (int)layers.size();
+  }
+
+  // The first hit is the longest suffix
+  vector< shared_ptr<Layer> > tail;
+  for (int i = 0; i < (int)layers.size(); i++) {
+    if (cache.find(getCacheKey(constraint, i), tail) && tail.size() == layers.size() - i) {
+      copy(tail.begin(), tail.end(), layers.begin() + i);
+      return i;
+    }
+  }
+  return (int)layers.size();
+}
+
+
+void ConstrainedMarkovModel::cacheLayers(const vector<string> &constraint, int layerEnd) {
+  LayerCache &cache = LayerCache::getInstance();
+  if (cache.getCapacity() == 0) {
+    return;
+  }
+
+  // Entries share their deeper layers, which the cache charges once
+  for (int i = layerEnd - 1; i >= 0; i--) {
+    vector< shared_ptr<Layer> > tail(layers.begin() + i, layers.end());
+    cache.insert(getCacheKey(constraint, i), tail);
+  }
+}
+
+
+string ConstrainedMarkovModel::getCacheKey(const vector<string> &constraint, int layerIndex) {
+  // Positions before markovOrder - 1 have shorter contexts, so their layers differ
+  string key = to_string(baseModel->getIndexId()) + ":" + typeid(*this).name() + ":"
+             + to_string(min(layerIndex, markovOrder - 1)) + ":";
+  for (int i = layerIndex; i < (int)constraint.size(); i++) {
+    key += constraint[i] + " ";
+  }
+  return key;
+}
+
+
+void ConstrainedMarkovModel::materializeLayer(int layerIndex, const vector<int> &wordIds) {
+  auto layer = make_shared<Layer>();
+  // Nodes are the position's states ending in one of the words (sorted, as words are)
+  for (int wordId : wordIds) {
+    for (int stateId = baseModel->getWordStatesBegin(wordId, layerIndex); stateId < baseModel->getWordStatesEnd(wordId, layerIndex); stateId++) {
+      layer->nodes.push_back(stateId);
+    }
+  }
+  layer->constraintNodes = wordIds;
+  layer->removedByConstraintCount = (int)(baseModel->getVocabulary().size() - baseModel->getFirstWordId() - wordIds.size());
+  layers[layerIndex] = layer;
+}
+
+
+void ConstrainedMarkovModel::makeWildcardLayer(int layerIndex) {
+  auto layer = make_shared<Layer>();
+  layer->isWildcard = true;  // live nodes are set by arc consistency
+  layers[layerIndex] = layer;
 }
 
 
@@ -86,89 +234,325 @@ void ConstrainedMarkovModel::increment(unordered_map< string, unordered_map<stri
 }
 
 
-void ConstrainedMarkovModel::removeDeadNodes() {
+void ConstrainedMarkovModel::removeDeadNodes(int layerEnd) {
+  // Prune back to front so the layer after each run is already consistent
+  int runEnd = layerEnd;
+  while (runEnd > 0) {
+    if (layers[runEnd - 1]->isWildcard) {
+      removeDeadWildcardNodes(runEnd - 1);
+      runEnd--;
+      continue;
+    }
+
+    int runBegin = runEnd - 1;
+    while (runBegin > 0 && !layers[runBegin - 1]->isWildcard) {
+      runBegin--;
+    }
+    removeDeadNodes(runBegin, runEnd);
+    runEnd = runBegin;
+  }
+}
+
+
+void ConstrainedMarkovModel::removeDeadNodes(int layerBegin, int layerEnd) {
+  const auto &targets = baseModel->getTransitionTargets();
+  int layerCount = (int)layers.size();
+  // The last layer's successors are unconstrained, so it is never pruned
+  int prunableEnd = min(layerEnd, layerCount - 1);
+  // A run followed by a wildcard layer keeps implicit edges into it
+  bool isNextWildcard = layerEnd < layerCount && layers[layerEnd]->isWildcard;
+  int linkEnd = isNextWildcard ? layerEnd - 1 : prunableEnd;
+
+  TaskPool &taskPool = TaskPool::getInstance();
+
+  // Link layers through the base model (layers are linked independently)
+  taskPool.parallelFor(layerBegin, linkEnd, 1, [&](int chunkBegin, int chunkEnd) {
+    vector<int> nextNodeIndices(baseModel->getStateCount(), -1);
+    for (int i = chunkBegin; i < chunkEnd; i++) {
+      linkLayer(i, nextNodeIndices);
+    }
+  });
+
   // Enforce arc-consistency
-  for (int i = (int)transitionMatrices.size() - 1; i > 0; i--) {
+  // This is a tree structured CSP, so no backtracking is needed
 
-    // This is a tree structured CSP, so no backtracking is needed
-    // Iterate through the previous word's matrix, looking at the tail
+  // Count live successors and build reverse adjacency (edges into each node of layer i+1)
+  vector< vector<int> > liveCounts(layerEnd);
+  vector< vector<int> > reverseOffsets(layerEnd);
+  vector< vector<int> > reverseSources(layerEnd);
+  vector< vector<bool> > isDead(layerEnd);
+  vector< pair<int, int> > worklist;  // (layer, node)
+
+  for (int i = layerBegin; i < layerEnd; i++) {
+    isDead[i].assign(layers[i]->size(), false);
+  }
 
-    auto *currWordMatrix = &transitionMatrices[i];
-    auto *prevWordMatrix = &transitionMatrices[i-1];
-    for (auto iter = prevWordMatrix->begin(); iter != prevWordMatrix->end();) {
+  // Layers are counted independently; nodes without live successors seed the worklist
+  vector< vector<int> > deadNodes(layerEnd);
+  taskPool.parallelFor(layerBegin, prunableEnd, 1, [&](int chunkBegin, int chunkEnd) {
+    for (int i = chunkBegin; i < chunkEnd; i++) {
+      const Layer &layer = *layers[i];
+      liveCounts[i].resize(layer.size());
+      if (i < linkEnd) {
+        for (int k = 0; k < layer.size(); k++) {
+          liveCounts[i][k] = layer.edgeOffsets[k+1] - layer.edgeOffsets[k];
+        }
+      } else {
+        // Successors in the (already consistent) wildcard layer come from the base model
+        const Layer &nextLayer = *layers[i+1];
+        taskPool.parallelFor(0, layer.size(), ROW_GRAIN, [&](int rowBegin, int rowEnd) {
+          for (int k = rowBegin; k < rowEnd; k++) {
+            int stateId = layer.nodes[k];
+            liveCounts[i][k] = 0;
+            for (int e = baseModel->getTransitionBegin(stateId); e < baseModel->getTransitionEnd(stateId); e++) {
+              if (nextLayer.indexOf(targets[e]) >= 0) {
+                liveCounts[i][k]++;
+              }
+            }
+          }
+        });
+      }
+      for (int k = 0; k < layer.size(); k++) {
+        if (liveCounts[i][k] == 0) {
+          deadNodes[i].push_back(k);
+        }
+      }
 
-      auto *prevWordMap = &iter->second;
-      for (auto prevInnerIter = prevWordMap->begin(); prevInnerIter != prevWordMap->end();) {
+      // Nodes of already consistent layers are never removed
+      if (i + 1 >= prunableEnd) {
+        continue;
+      }
 
-        // Remove edges that do not lead to the next word
-        if (currWordMatrix->find(prevInnerIter->first) == currWordMatrix->end()) {
-          prevInnerIter = prevWordMap->erase(prevInnerIter);
-        } else {
-          prevInnerIter++;
+      // Counting sort of edges by target
+      vector<int> *offsets = &reverseOffsets[i+1];
+      offsets->assign(layers[i+1]->size() + 1, 0);
+      for (int target : layer.edgeTargets) {
+        (*offsets)[target + 1]++;
+      }
+      for (int k = 0; k < layers[i+1]->size(); k++) {
+        (*offsets)[k + 1] += (*offsets)[k];
+      }
+      vector<int> position(offsets->begin(), offsets->end() - 1);
+      reverseSources[i+1].resize(layer.edgeTargets.size());
+      for (int k = 0; k < layer.size(); k++) {
+        for (int e = layer.edgeOffsets[k]; e < layer.edgeOffsets[k+1]; e++) {
+          reverseSources[i+1][position[layer.edgeTargets[e]]++] = k;
         }
       }
+    }
+  });
+  for (int i = layerBegin; i < prunableEnd; i++) {
+    for (int k : deadNodes[i]) {
+      worklist.emplace_back(i, k);
+    }
+  }
 
-      // Remove a node if there are no edges coming out of it
-      if (prevWordMap->empty()) {
-        removedNodesbyArcConsistency[i-1].push_back(iter->first);  // Save removed nodes
-        iter = prevWordMatrix->erase(iter);
-      // Remove start nodes; a start matrix will be added after
-      } else if (iter->first.compare(START) == 0) {
-          iter = prevWordMatrix->erase(iter);
-      } else {
-        iter++;
+  // Propagate deletions backward
+  while (!worklist.empty()) {
+    int i = worklist.back().first;
+    int k = worklist.back().second;
+    worklist.pop_back();
+
+    isDead[i][k] = true;
+    layers[i]->removedByArcConsistency.push_back(baseModel->getStateWord(layers[i]->nodes[k]));  // Save removed nodes
+
+    if (i == layerBegin) {
+      continue;
+    }
+    for (int r = reverseOffsets[i][k]; r < reverseOffsets[i][k+1]; r++) {
+      int source = reverseSources[i][r];
+      if (!isDead[i-1][source] && --liveCounts[i-1][source] == 0) {
+        worklist.emplace_back(i-1, source);
+      }
+    }
+  }
+
+  // Compact layers, dropping dead nodes and the edges leading to them
+  vector<int> nextIndices;
+  if (layerEnd < layerCount && !isNextWildcard) {
+    // The next layer is already consistent and keeps its indices
+    nextIndices.resize(layers[layerEnd]->size());
+    for (int k = 0; k < (int)nextIndices.size(); k++) {
+      nextIndices[k] = k;
+    }
+  }
+  for (int i = layerEnd - 1; i >= layerBegin; i--) {
+    Layer *layer = layers[i].get();
+    bool hasEdges = i < layerCount - 1 && i < linkEnd;
+    Layer compacted;
+    compacted.nodes.reserve(layer->size());
+    compacted.edgeOffsets.reserve(layer->size() + 1);
+    compacted.edgeOffsets.push_back(0);
+
+    vector<int> indices(layer->size(), -1);
+    for (int k = 0; k < layer->size(); k++) {
+      if (isDead[i][k]) {
+        continue;
       }
+      indices[k] = compacted.size();
+      compacted.nodes.push_back(layer->nodes[k]);
+
+      if (hasEdges) {
+        for (int e = layer->edgeOffsets[k]; e < layer->edgeOffsets[k+1]; e++) {
+          int target = nextIndices[layer->edgeTargets[e]];
+          if (target >= 0) {
+            compacted.edgeTargets.push_back(target);
+            compacted.edgeProbs.push_back(layer->edgeProbs[e]);
+          }
+        }
+      }
+      compacted.edgeOffsets.push_back((int)compacted.edgeTargets.size());
+    }
+
+    if (i >= linkEnd && i < layerCount - 1) {
+      compacted.edgeOffsets.clear();  // implicit edges into the wildcard layer
     }
+
+    layer->nodes = move(compacted.nodes);
+    layer->edgeOffsets = move(compacted.edgeOffsets);
+    layer->edgeTargets = move(compacted.edgeTargets);
+    layer->edgeProbs = move(compacted.edgeProbs);
+    nextIndices = move(indices);
   }
 }
 
 
-void ConstrainedMarkovModel::normalize() {
-  // We first normalize individually the last matrix (Pachet) **CITE
-  double prevSum;
+void ConstrainedMarkovModel::removeDeadWildcardNodes(int layerIndex) {
+  const auto &targets = baseModel->getTransitionTargets();
+  int stateCount = baseModel->getStateCount();
+  int statesBegin = baseModel->getPositionStatesBegin(layerIndex);
+  int statesEnd = baseModel->getPositionStatesEnd(layerIndex);
+  Layer *layer = layers[layerIndex].get();
+
+  layer->liveNodes = Bitset(stateCount);
+  layer->removedByArcConsistency.clear();
+
+  // The last layer's successors are unconstrained, so every state of the position is live
+  if (layerIndex == (int)layers.size() - 1) {
+    for (int stateId = statesBegin; stateId < statesEnd; stateId++) {
+      layer->liveNodes.set(stateId);
+    }
+    return;
+  }
 
-  vector< unordered_map<string, double> > aSums;
-  aSums.reserve(transitionMatrices.size());
-  for (int i = (int)transitionMatrices.size() - 1; i >= 0; i--) {
-    aSums.emplace_back(unordered_map<string, double>());
+  const Layer &nextLayer = *layers[layerIndex + 1];
+  Bitset nextLiveNodes;
+  if (nextLayer.isWildcard) {
+    nextLiveNodes = nextLayer.liveNodes;
+  } else {
+    nextLiveNodes = Bitset(stateCount);
+    for (int stateId : nextLayer.nodes) {
+      nextLiveNodes.set(stateId);
+    }
   }
 
-  for (int i = (int)transitionMatrices.size() - 1; i >= 0; i--) {
+  // A state is live if any of its base model successors is live
+  // (tasks cover whole 64-state blocks so they never share a bitset word)
+  TaskPool::getInstance().parallelFor(statesBegin / 64, (statesEnd + 63) / 64, ROW_GRAIN / 64, [&](int blockBegin, int blockEnd) {
+    for (int stateId = max(statesBegin, blockBegin * 64); stateId < min(statesEnd, blockEnd * 64); stateId++) {
+      bool isLive = false;
+      for (int e = baseModel->getTransitionBegin(stateId); e < baseModel->getTransitionEnd(stateId) && !isLive; e++) {
+        isLive = nextLiveNodes.test(targets[e]);
+      }
+      if (isLive) {
+        layer->liveNodes.set(stateId);
+      }
+    }
+  });
+  for (int stateId = statesBegin; stateId < statesEnd; stateId++) {
+    if (!layer->liveNodes.test(stateId)) {
+      layer->removedByArcConsistency.push_back(baseModel->getStateWord(stateId));
+    }
+  }
+}
 
-    auto *transitionMap = &transitionMatrices[i];
 
+void ConstrainedMarkovModel::linkLayer(int layerIndex, vector<int> &nextNodeIndices) {
+  const auto &targets = baseModel->getTransitionTargets();
 
-    for (auto &map : *transitionMap) {
-      auto *innerMap = &map.second;
-      double sumA = 0.0;
+  Layer *layer = layers[layerIndex].get();
+  const Layer &nextLayer = *layers[layerIndex + 1];
 
-      // Normalize for the last transition matrix
-      if (i == (int)transitionMatrices.size() - 1) {
-        // normalize in a normal fashion
-        for (const auto &pair : *innerMap) {
-          sumA += pair.second;  // update sumA
-        }
+  for (int k = 0; k < nextLayer.size(); k++) {
+    nextNodeIndices[nextLayer.nodes[k]] = k;
+  }
 
-      // Normalize for 0 to L-1 transition matrices
-      } else {
-        for (const auto &pair : *innerMap) {
-          prevSum = aSums[i+1][pair.first];
-          sumA += prevSum * pair.second;  // update sumA
-        }
+  layer->edgeOffsets.assign(1, 0);
+  layer->edgeTargets.clear();
+  layer->edgeProbs.clear();
+  for (int wordId : layer->nodes) {
+    for (int e = baseModel->getTransitionBegin(wordId); e < baseModel->getTransitionEnd(wordId); e++) {
+      int target = nextNodeIndices[targets[e]];
+      if (target >= 0) {
+        layer->edgeTargets.push_back(target);
+        layer->edgeProbs.push_back(baseModel->getTransitionProbability(wordId, e));
       }
+    }
+    layer->edgeOffsets.push_back((int)layer->edgeTargets.size());
+  }
+
+  // Reset the scratch array
+  for (int wordId : nextLayer.nodes) {
+    nextNodeIndices[wordId] = -1;
+  }
+}
 
-      aSums[i][map.first] = sumA;  // save sums for later use
 
-      for (const auto &pair : *innerMap) {
-        if (i == transitionMatrices.size() - 1) {
-          // normalize individually for the last matrix
-          innerMap->at(pair.first) /= sumA;
-        } else {
-          prevSum = aSums[i+1][pair.first];
-          // normalize in a propagating manor for the middle and first matrices
-          innerMap->at(pair.first) = innerMap->at(pair.first) * prevSum / sumA;
+void ConstrainedMarkovModel::normalize(int layerEnd) {
+  // We first normalize individually the last matrix (Pachet) **CITE
+  const auto &baseTargets = baseModel->getTransitionTargets();
+  const auto &baseCounts = baseModel->getTransitionCounts();
+  vector<double> denseSums;
+  TaskPool &taskPool = TaskPool::getInstance();
+
+  // Rows of a layer are independent and are split across the task pool
+  for (int i = layerEnd - 1; i >= 0; i--) {
+    Layer *layer = layers[i].get();
+    layer->sums.assign(layer->size(), 0.0);
+
+    // Normalize for the last transition matrix
+    if (i == (int)layers.size() - 1) {
+      // normalize in a normal fashion (the last layer's successors are unconstrained,
+      // so a row's counts sum to its total)
+      taskPool.parallelFor(0, layer->size(), ROW_GRAIN, [&](int rowBegin, int rowEnd) {
+        for (int k = rowBegin; k < rowEnd; k++) {
+          if (!layer->isLive(k)) {
+            continue;
+          }
+          layer->sums[k] = (baseModel->getRowTotal(layer->nodeId(k)) > 0) ? 1.0 : 0.0;
+        }
+      });
+
+    // Implicit edges are sparse products of base model rows with the next sums by vocabulary ID
+    // (normalized on the fly, see forEachEdge())
+    } else if (layer->edgeOffsets.empty()) {
+      const Layer &nextLayer = *layers[i+1];
+      const double *nextSums = nextLayer.sums.data();
+      if (!nextLayer.isWildcard) {
+        denseSums.assign(baseModel->getStateCount(), 0.0);
+        for (int k = 0; k < nextLayer.size(); k++) {
+          denseSums[nextLayer.nodes[k]] = nextLayer.sums[k];
         }
+        nextSums = denseSums.data();
       }
+      taskPool.parallelFor(0, layer->size(), ROW_GRAIN, [&](int rowBegin, int rowEnd) {
+        for (int k = rowBegin; k < rowEnd; k++) {
+          if (!layer->isLive(k)) {
+            continue;
+          }
+          int stateId = layer->nodeId(k);
+          layer->sums[k] = NormalizeKernel::dotRange(baseTargets.data(), baseCounts.data(), nextSums,
+                                                     baseModel->getTransitionBegin(stateId), baseModel->getTransitionEnd(stateId))
+                           / baseModel->getRowTotal(stateId);
+        }
+      });
+
+    // Normalize in a propagating manor for the middle and first matrices
+    } else {
+      taskPool.parallelFor(0, layer->size(), ROW_GRAIN, [&](int rowBegin, int rowEnd) {
+        NormalizeKernel::normalizeRows(layer->edgeOffsets.data(), layer->edgeTargets.data(), layer->edgeProbs.data(),
+                                       layers[i+1]->sums.data(), layer->sums.data(), rowBegin, rowEnd);
+      });
     }
   }
 }
@@ -176,41 +560,45 @@ void ConstrainedMarkovModel::normalize() {
 
 void ConstrainedMarkovModel::addStartTransition() {
   // Word frequencies are used as the prior probabilities
-  unordered_map<string, int> wordFrequencies = getWordFrequencies(this->trainingSequences);
-
-  // create new matrix with start as the only node to all the other transitionMatrices[1] firsts
-  // then insert the new start matrix at the front of transitionMatrices
-  unordered_map< string, unordered_map<string, double> > startTransition;
-
-  unordered_map<string, double> innerStartMap;
-  // transitionMatrices[0] represents the possible starting words (not START yet)
-  for (const auto &map : transitionMatrices[0]) {
+  // create new layer with start as the only node to all the other layers[0] nodes
+  // then insert the new start layer at the front of layers
+  auto startTransition = make_shared<Layer>();
+  startTransition->nodes.push_back(baseModel->getWordId(START));
+  startTransition->edgeOffsets.push_back(0);
+
+  // layers[0] represents the possible starting words (not START yet)
+  for (int k = 0; k < layers[0]->size(); k++) {
+    if (!layers[0]->isLive(k)) {
+      continue;
+    }
     // starting probabilities determined frequency
-    innerStartMap.insert(make_pair(map.first, wordFrequencies[map.first]));
+    startTransition->edgeTargets.push_back(k);
+    startTransition->edgeProbs.push_back(baseModel->getWordFrequency(baseModel->getStateWord(layers[0]->nodeId(k))));
   }
-  startTransition.insert(make_pair(START, innerStartMap));
+  startTransition->edgeOffsets.push_back((int)startTransition->edgeTargets.size());
 
-  transitionMatrices.insert(transitionMatrices.begin(), startTransition);
+  layers.insert(layers.begin(), startTransition);
 }
 
 
 vector<string> ConstrainedMarkovModel::generateSentence() {
 
-  if (transitionMatrices.empty()) {
+  if (layers.empty()) {
     printf("ERROR::Model is not trained.\n");  // TODO: throw error
     return vector<string>();
   }
 
+  const auto &vocabulary = baseModel->getVocabulary();
   vector<string> sentence;
 
-  string nextWord = getNextWord(START, 0);
-  sentence.push_back(nextWord);
+  // Draw the random values of the whole walk at once
+  vector<double> randVals(layers.size() - 1);
+  randGenerator.fillDoubles(randVals.data(), (int)randVals.size());
 
-  string prevWord = nextWord;
-  for (int i = 1; i < transitionMatrices.size() - 1; i++) {
-    nextWord = getNextWord(prevWord, i);
-    sentence.push_back(nextWord);
-    prevWord = nextWord;
+  int node = 0;  // START
+  for (int i = 0; i < (int)layers.size() - 1; i++) {
+    node = (node >= 0) ? getNextNode(i, node, randVals[i]) : -1;
+    sentence.push_back((node >= 0) ? vocabulary[baseModel->getStateWord(layers[i+1]->nodeId(node))] : "");
   }
 
   return sentence;
@@ -222,14 +610,20 @@ vector<vector<string> > ConstrainedMarkovModel::generateSentences(Options option
   // Generate sentences
   startTime = clock();
   vector<vector<string> > generatedSentences;
-  generatedSentences.reserve(options.getSentenceCount());
-  for (int i = 0; i < options.getSentenceCount(); i++) {
-    generatedSentences.push_back(this->generateSentence());
+  if (options.getDecodeBest()) {
+    generatedSentences = this->generateBestSentences(options.getSentenceCount());
+  } else if (options.getDistinctSentences()) {
+    generatedSentences = this->sampleDistinctSentences(options.getSentenceCount());
+  } else {
+    generatedSentences = this->sampleSentences(options.getSentenceCount());
   }
   Console::debugPrint("\n%-35s: %f\n", "Elapsed Sentence(s) Gen Time", (float)(clock() - startTime) / CLOCKS_PER_SEC);
 
   // Print generated sentences with probabilities (debug)
-  Console::debugPrint("%s  (%d)\n", "Generated Sentences", options.getSentenceCount());
+  if (!Debug::getIsDebugEnabled()) {
+    return generatedSentences;  // skip scoring every sentence
+  }
+  Console::debugPrint("%s  (%d)\n", "Generated Sentences", (int)generatedSentences.size());
   Console::debugPrint("%-10s: %s\n", "(prob)", "(sentence)");
   for (const auto &sentence : generatedSentences) {
     Console::debugPrint("%-10f: ", this->getSentenceProbability(sentence));
@@ -244,46 +638,236 @@ vector<vector<string> > ConstrainedMarkovModel::generateSentences(Options option
 }
 
 
-double ConstrainedMarkovModel::getSentenceProbability(vector<string> sentence) {
-  double prob = 1.0;
+vector<vector<string> > ConstrainedMarkovModel::sampleSentences(int count) {
+  vector<vector<string> > sentences;
+  if (layers.empty()) {
+    printf("ERROR::Model is not trained.\n");
+    return sentences;
+  }
 
-  string currWord;
-  string nextWord;
+  sentences.reserve(max(count, 0));
+  vector<int> path;
+  if (count > 0) {
+    sampleSentences(0, 0, count, path, sentences);  // START
+  }
 
-  for (int i = 0; i < transitionMatrices.size(); i++) {
-    if (i >= sentence.size()) {
-      break;
+  // Sentences come out grouped by prefix
+  shuffle(sentences.begin(), sentences.end(), randGenerator);
+  return sentences;
+}
+
+
+void ConstrainedMarkovModel::sampleSentences(int layerIndex, int nodeIndex, int count, vector<int> &path, vector<vector<string> > &sentences) {
+  int pathSize = (int)path.size();
+  int assignedCount = 0;
+
+  // A single sentence walks the rest of the way like generateSentence()
+  if (count == 1) {
+    vector<double> randVals(layers.size() - 1 - layerIndex);
+    randGenerator.fillDoubles(randVals.data(), (int)randVals.size());
+    for (int i = layerIndex; i + 1 < (int)layers.size() && nodeIndex >= 0; i++) {
+      nodeIndex = getNextNode(i, nodeIndex, randVals[i - layerIndex]);
+      if (nodeIndex >= 0) {
+        path.push_back(nodeIndex);
+      }
     }
-    auto currentMatrix = transitionMatrices[i];
-    if (i == 0) {
-      currWord = START;
-      nextWord = sentence[i];
-    } else {
-      currWord = sentence[i-1];
-      nextWord = sentence[i];
+  } else if (layerIndex + 1 < (int)layers.size()) {
+    vector<int> targets;
+    vector<double> probs;
+    forEachEdge(layerIndex, nodeIndex, [&](int target, double prob) {
+      targets.push_back(target);
+      probs.push_back(prob);
+      return false;
+    });
+
+    vector<int> counts(targets.size());
+    splitMultinomial(count, probs.data(), (int)probs.size(), randGenerator, counts.data());
+    for (int k = 0; k < (int)targets.size(); k++) {
+      if (counts[k] > 0) {
+        path.push_back(targets[k]);
+        sampleSentences(layerIndex + 1, targets[k], counts[k], path, sentences);
+        path.pop_back();
+        assignedCount += counts[k];
+      }
+    }
+  }
+
+  // Complete paths, or dead ends padded with empty words as in generateSentence()
+  if (assignedCount < count) {
+    const auto &vocabulary = baseModel->getVocabulary();
+    vector<string> sentence(layers.size() - 1, "");
+    for (int i = 0; i < (int)path.size(); i++) {
+      sentence[i] = vocabulary[baseModel->getStateWord(layers[i+1]->nodeId(path[i]))];
+    }
+    sentences.insert(sentences.end(), count - assignedCount, sentence);
+  }
+  path.resize(pathSize);
+}
+
+
+vector<vector<string> > ConstrainedMarkovModel::sampleDistinctSentences(int count) {
+  if (layers.empty()) {
+    printf("ERROR::Model is not trained.\n");
+    return vector<vector<string> >();
+  }
+
+  // Every solution is returned when there are too few to choose from
+  SolutionCount solutionCount = getTotalSolutionCount();
+  if (solutionCount.isExact && solutionCount.exact <= (unsigned __int128)max(count, 0)) {
+    return generateBestSentences((int)solutionCount.exact);
+  }
+
+  // The virtual root enters START
+  auto edges = [&](int layerIndex, int nodeIndex, auto g) {
+    if (layerIndex < 0) {
+      g(0, 1.0);
+      return;
     }
+    forEachEdge(layerIndex, nodeIndex, [&](int target, double prob) {
+      g(target, prob);
+      return false;
+    });
+  };
+  vector<vector<int> > paths = samplePathsWithoutReplacement((int)layers.size(), edges, count, randGenerator);
+
+  const auto &vocabulary = baseModel->getVocabulary();
+  vector<vector<string> > sentences;
+  for (const auto &path : paths) {
+    vector<string> sentence;
+    for (int i = 1; i < (int)layers.size(); i++) {
+      sentence.push_back(vocabulary[baseModel->getStateWord(layers[i]->nodeId(path[i]))]);
+    }
+    sentences.push_back(sentence);
+  }
+  return sentences;
+}
+
+
+vector<vector<string> > ConstrainedMarkovModel::generateBestSentences(int count) {
+  vector<vector<string> > sentences;
+  if (layers.empty()) {
+    printf("ERROR::Model is not trained.\n");
+    return sentences;
+  }
+
+  // Path scores are sums of log edge probabilities from START
+  vector<int> layerSizes;
+  for (const auto &layer : layers) {
+    layerSizes.push_back(layer->size());
+  }
+  const Layer &lastLayer = *layers.back();
+  auto endScore = [&](int nodeIndex) {
+    return lastLayer.isLive(nodeIndex) ? 0.0 : -INFINITY;
+  };
+  auto logEdges = [&](int layerIndex, int nodeIndex, auto g) {
+    if (!layers[layerIndex]->isLive(nodeIndex)) {
+      return;
+    }
+    forEachEdge(layerIndex, nodeIndex, [&](int target, double prob) {
+      if (prob > 0.0) {
+        g(target, log(prob));
+      }
+      return false;
+    });
+  };
+  vector<ScoredPath> paths = findBestPaths(layerSizes, vector<double>(1, 0.0), endScore, logEdges, count);
+
+  const auto &vocabulary = baseModel->getVocabulary();
+  for (const auto &path : paths) {
+    vector<string> sentence;
+    for (int i = 1; i < (int)layers.size(); i++) {
+      sentence.push_back(vocabulary[baseModel->getStateWord(layers[i]->nodeId(path.nodes[i]))]);
+    }
+    sentences.push_back(sentence);
+  }
+  return sentences;
+}
+
 
-    double p = currentMatrix[currWord][nextWord];
+double ConstrainedMarkovModel::getSentenceProbability(const vector<string> &sentence) const {
+  double prob = 1.0;
+
+  int node = 0;  // START
+  for (int i = 0; i < (int)layers.size() - 1; i++) {
+    if (i >= (int)sentence.size() || node < 0) {
+      break;
+    }
+    const Layer &nextLayer = *layers[i+1];
+
+    // The next node is the successor state ending in the sentence's word
+    int wordId = baseModel->getWordId(sentence[i]);
+    int nextNode = -1;
+    double p = 0.0;
+    if (wordId >= 0) {
+      forEachEdge(i, node, [&](int target, double edgeProb) {
+        if (baseModel->getStateWord(nextLayer.nodeId(target)) == wordId) {
+          nextNode = target;
+          p = edgeProb;
+          return true;
+        }
+        return false;
+      });
+    }
     if (p != 0)
-        prob *= p;
+      prob *= p;
+    node = nextNode;
   }
   return prob;
 }
 
 
-string ConstrainedMarkovModel::getNextWord(string prevWord, int wordIndex) {
-  unordered_map<string, double> map = transitionMatrices[wordIndex][prevWord];
-  double randVal = randDistribution(randGenerator);
-
-  double sum = 0.0;
-  for (const auto &pair : map) {
-    sum += map[pair.first];
+double ConstrainedMarkovModel::getSentenceLogProbability(const vector<int> &wordIds) const {
+  if (layers.empty() || (int)wordIds.size() != (int)layers.size() - 1) {
+    return -INFINITY;
+  }
 
-    if (sum > randVal) {
-      return pair.first;
+  double logProb = 0.0;
+  int node = 0;  // START
+  for (int i = 0; i < (int)wordIds.size(); i++) {
+    const Layer &nextLayer = *layers[i+1];
+
+    // The next node is the successor state ending in the sentence's word
+    int nextNode = -1;
+    double p = 0.0;
+    forEachEdge(i, node, [&](int target, double edgeProb) {
+      if (baseModel->getStateWord(nextLayer.nodeId(target)) == wordIds[i]) {
+        nextNode = target;
+        p = edgeProb;
+        return true;
+      }
+      return false;
+    });
+    if (nextNode < 0 || p <= 0.0) {
+      return -INFINITY;
     }
+    logProb += log(p);
+    node = nextNode;
   }
-  return "";  // TODO: throw error
+  return logProb;
+}
+
+
+vector<double> ConstrainedMarkovModel::getSentenceLogProbabilities(const vector< vector<int> > &sentences) const {
+  vector<double> logProbs(sentences.size());
+  TaskPool::getInstance().parallelFor(0, (int)sentences.size(), 64, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      logProbs[i] = getSentenceLogProbability(sentences[i]);
+    }
+  });
+  return logProbs;
+}
+
+
+int ConstrainedMarkovModel::getNextNode(int layerIndex, int nodeIndex, double randVal) {
+
+  double sum = 0.0;
+  int nextNode = -1;  // TODO: throw error if there is no edge
+  forEachEdge(layerIndex, nodeIndex, [&](int target, double prob) {
+    sum += prob;
+    nextNode = target;  // Rounding may leave the sum just under randVal
+    return sum > randVal;
+  });
+  return nextNode;
 }
 
 
@@ -299,72 +883,97 @@ double ConstrainedMarkovModel::calculateProbability(vector<string> sentence) {
 
     string currWord = sentence[i];
 
-    prob *= transitionProbs[prevWord][currWord];
+    double p = baseModel->getTransitionProbability(prevWord, currWord);
+    if (p == 0.0) {
+      return 0.0;
+    }
+    prob *= p;
   }
   return prob;
 }
 
 
-unordered_map<string, int> ConstrainedMarkovModel::getWordFrequencies(vector< vector<string> > sentences) {
-  unordered_map<string, int> frequencies;
-
-  for (const auto &sentence : sentences) {
-    for (const auto &word : sentence) {
-      frequencies[word]++;
-    }
-  }
-  return frequencies;
+string ConstrainedMarkovModel::sampleRemovedNodeByConstraint(int layerIndex) {
+  return sampleRemovedNodesByConstraint(layerIndex, 1)[0];
 }
 
 
-string ConstrainedMarkovModel::sampleRemovedNodeByConstraint(int layerIndex) {
-  return sampleRemovedNodes(removedNodesbyConstraint, layerIndex);
+string ConstrainedMarkovModel::sampleRemovedNodeByConstraint(const Layer &layer) {
+  return sampleRemovedNodesByConstraint(layer, 1)[0];
 }
 
 
-string ConstrainedMarkovModel::sampleRemovedNodeByArcConsistency(int layerIndex) {
-  return sampleRemovedNodes(removedNodesbyArcConsistency, layerIndex);
+vector<string> ConstrainedMarkovModel::sampleRemovedNodesByConstraint(int layerIndex, int count) {
+  return sampleRemovedNodesByConstraint(*layers[layerIndex + 1], count);  // offset by the start matrix
 }
 
 
-string ConstrainedMarkovModel::sampleRemovedNodes(vector< vector<string> > nodes, int layerIndex) {
-  if (nodes[layerIndex].size() == 0) {
-    return "";
+vector<string> ConstrainedMarkovModel::sampleRemovedNodesByConstraint(const Layer &layer, int count) {
+  const auto &vocabulary = baseModel->getVocabulary();
+  const auto &keptIds = layer.constraintNodes;
+  int firstWordId = baseModel->getFirstWordId();
+  int removedCount = (int)vocabulary.size() - firstWordId - (int)keptIds.size();
+  if (layer.removedByConstraintCount == 0 || removedCount <= 0) {
+    return vector<string>(count, "");
   }
-  double randVal = randDistribution(randGenerator);
-  double wordFraction = 1 / (float)nodes[layerIndex].size();
 
-  double sum = 0.0;
-  for (const auto &word : nodes[layerIndex]) {
-    sum += wordFraction;
-
-    if (sum > randVal) {
-      return word;
+  // Removed nodes are every word not kept in the layer. The kept words
+  // before the rank-th removed word are those with fewer removed words
+  // before them than the rank (keptIds[j] - firstWordId - j)
+  vector<double> randVals(count);
+  randGenerator.fillDoubles(randVals.data(), count);
+  vector<string> words(count);
+  for (int i = 0; i < count; i++) {
+    int rank = min((int)(randVals[i] * removedCount), removedCount - 1);
+    int low = 0;
+    int high = (int)keptIds.size();
+    while (low < high) {
+      int middle = (low + high) / 2;
+      if (keptIds[middle] - firstWordId - middle <= rank) {
+        low = middle + 1;
+      } else {
+        high = middle;
+      }
     }
+    words[i] = vocabulary[firstWordId + rank + low];
   }
-  return "";  // TODO: throw error
+  return words;
 }
 
 
-void ConstrainedMarkovModel::initRemovedNodeArrays(int arraySize) {
-  removedNodesbyConstraint.resize(arraySize);
-  removedNodesbyArcConsistency.resize(arraySize);
+string ConstrainedMarkovModel::sampleRemovedNodeByArcConsistency(int layerIndex) {
+  return sampleRemovedNodesByArcConsistency(layerIndex, 1)[0];
 }
 
 
-vector<int> ConstrainedMarkovModel::getTransitionMatricesSizes() {
-  vector<int> sizes;
+vector<string> ConstrainedMarkovModel::sampleRemovedNodesByArcConsistency(int layerIndex, int count) {
+  return sampleRemovedNodes(layers[layerIndex + 1]->removedByArcConsistency, count);  // offset by the start matrix
+}
+
 
-  sizes.reserve(transitionMatrices.size());
-  for (int i = 0; i < transitionMatrices.size(); i++) {
-    sizes.push_back((int)transitionMatrices[i].size());
+vector<string> ConstrainedMarkovModel::sampleRemovedNodes(const vector<int> &nodes, int count) {
+  if (nodes.size() == 0) {
+    return vector<string>(count, "");
   }
-  return sizes;
+  vector<double> randVals(count);
+  randGenerator.fillDoubles(randVals.data(), count);
+  vector<string> words(count);
+  int size = (int)nodes.size();
+  for (int i = 0; i < count; i++) {
+    words[i] = baseModel->getVocabulary()[nodes[min((int)(randVals[i] * size), size - 1)]];
+  }
+  return words;
 }
 
 
-vector< vector<string> > ConstrainedMarkovModel::getTrainingSequences() {
-  return this->trainingSequences;
+vector<int> ConstrainedMarkovModel::getTransitionMatricesSizes() {
+  vector<int> sizes;
+
+  sizes.reserve(layers.size());
+  for (int i = 0; i < (int)layers.size(); i++) {
+    sizes.push_back(layers[i]->liveCount());
+  }
+  return sizes;
 }
 
 
@@ -373,7 +982,7 @@ void ConstrainedMarkovModel::printDebugInfo(Options options) {
   Console::debugPrint("\n%-35s: %d\n", "Markov Order", this->getMarkovOrder());
 
   // Print training sequence count
-  Console::debugPrint("%-35s: %d\n", "Training Sentence Count", this->getTrainingSequences().size());
+  Console::debugPrint("%-35s: %d\n", "Training Sentence Count", (int)baseModel->getSentenceCount());
 
   // Print matrix sizes (debug)
   Console::debugPrint("%-35s: ", "Transition Matrix sizes");
@@ -386,21 +995,29 @@ void ConstrainedMarkovModel::printDebugInfo(Options options) {
   if (Debug::getIsDeepDebugEnabled()) {
     // Print total solution count (expensive)
     time_t startTime = clock();
-    int solutionCount = this->getTotalSolutionCount();
+    SolutionCount solutionCount = this->getTotalSolutionCount();
     Console::debugPrint("%-35s: %f\n", "Elapsed Time Calculating TSC", (float)(clock() - startTime)/CLOCKS_PER_SEC);
-    Console::debugPrint("%-35s: %d\n", "Total Solution Count", solutionCount);
+    Console::debugPrint("%-35s: %s (log10 %f)\n", "Total Solution Count", solutionCount.toString().c_str(), solutionCount.log10Count);
   }
 }
 
 
 void ConstrainedMarkovModel::printTransitionProbs() {
-  for (const auto &matrix : transitionMatrices) {
-    for (const auto &firstWord : matrix) {
-      printf("%20s >>> ", firstWord.first.c_str());
+  const auto &vocabulary = baseModel->getVocabulary();
+  for (int i = 0; i < (int)layers.size(); i++) {
+    const Layer &layer = *layers[i];
+    for (int k = 0; k < layer.size(); k++) {
+      if (!layer.isLive(k)) {
+        continue;
+      }
+      printf("%20s >>> ", vocabulary[baseModel->getStateWord(layer.nodeId(k))].c_str());
       double sum = 0.0;
-      for (const auto &nextWord : firstWord.second) {
-        printf("%s:(%0.3f) ", nextWord.first.c_str(), nextWord.second);
-        sum += nextWord.second;
+      if (i < (int)layers.size() - 1) {
+        forEachEdge(i, k, [&](int target, double prob) {
+          printf("%s:(%0.3f) ", vocabulary[baseModel->getStateWord(layers[i+1]->nodeId(target))].c_str(), prob);
+          sum += prob;
+          return false;
+        });
       }
       printf(" sum: >%f<", sum);
       printf("\n");
@@ -408,29 +1025,75 @@ void ConstrainedMarkovModel::printTransitionProbs() {
   }
 }
 
-int ConstrainedMarkovModel::getTotalSolutionCount() {
-  // Perform recursive depth first search on matrices to count solutions
-  int count = 0;
-  getTotalSolutionCountImpl(START, 0, count);
-  return count;
-}
-
-void ConstrainedMarkovModel::getTotalSolutionCountImpl(string nodeStr, int matrixIndex, int& count) {
-  auto *currentMatrix = &transitionMatrices[matrixIndex];
-  // auto *nextMatrix = &transitionMatrices[matrixIndex+1];
+SolutionCount ConstrainedMarkovModel::getTotalSolutionCount() const {
+  const unsigned __int128 maxCount = ~(unsigned __int128)0;
 
-  // Find current node
-  auto node = currentMatrix->find(nodeStr);
+  SolutionCount solutionCount;
+  solutionCount.exact = 0;
+  solutionCount.isExact = true;
+  solutionCount.log10Count = -INFINITY;
+  if (layers.empty()) {
+    return solutionCount;
+  }
 
-  auto *nextNodes = &node->second;
-  for (auto nextNode = nextNodes->begin(); nextNode != nextNodes->end(); nextNode++) {
+  // Paths from each node to the last layer, exact (saturating) and as
+  // doubles rescaled per layer with the scale kept in log space
+  vector<unsigned __int128> counts(layers.back()->size(), 1);
+  vector<double> scaledCounts(layers.back()->size(), 1.0);
+  double log10Scale = 0.0;
+
+  for (int i = (int)layers.size() - 2; i >= 0; i--) {
+    const Layer &layer = *layers[i];
+    vector<unsigned __int128> layerCounts(layer.size(), 0);
+    vector<double> layerScaledCounts(layer.size(), 0.0);
+    double maxScaledCount = 0.0;
+
+    for (int k = 0; k < layer.size(); k++) {
+      if (!layer.isLive(k)) {
+        continue;
+      }
+      forEachEdge(i, k, [&](int target, double) {
+        unsigned __int128 count = counts[target];
+        layerCounts[k] = (layerCounts[k] > maxCount - count) ? maxCount : layerCounts[k] + count;
+        layerScaledCounts[k] += scaledCounts[target];
+        return false;
+      });
+      maxScaledCount = max(maxScaledCount, layerScaledCounts[k]);
+    }
 
-    // If next nodes are in final matrix, count them towards total solutions
-    if (matrixIndex+1 == this->transitionMatrices.size()-1) {
-      count++;
-    // Else continue down the matrices
-    } else {
-      this->getTotalSolutionCountImpl(nextNode->first, matrixIndex+1, count);
+    if (maxScaledCount > 0.0) {
+      for (double &count : layerScaledCounts) {
+        count /= maxScaledCount;
+      }
+      log10Scale += log10(maxScaledCount);
     }
+    counts = move(layerCounts);
+    scaledCounts = move(layerScaledCounts);
   }
+
+  // layers[0] holds only START
+  solutionCount.exact = counts[0];
+  solutionCount.isExact = counts[0] != maxCount;
+  if (scaledCounts[0] > 0.0) {
+    solutionCount.log10Count = log10(scaledCounts[0]) + log10Scale;
+  }
+  return solutionCount;
+}
+
+
+string SolutionCount::toString() const {
+  if (!isExact) {
+    char buffer[64];
+    double mantissa = pow(10.0, log10Count - floor(log10Count));
+    snprintf(buffer, sizeof(buffer), "%.6fe+%d", mantissa, (int)floor(log10Count));
+    return string(buffer);
+  }
+
+  string digits;
+  unsigned __int128 value = exact;
+  do {
+    digits += (char)('0' + (int)(value % 10));
+    value /= 10;
+  } while (value != 0);
+  return string(digits.rbegin(), digits.rend());
 }
@@ -5,12 +5,33 @@
 #include <vector>
 #include <unordered_map>
 #include <random>
+#include <memory>
 
 #include "markov.h"
+#include "layer.h"
 
 using namespace std;
 
 
+/**
+ * @brief Count of the sentences a constrained model can generate
+ */
+struct SolutionCount {
+  /// Exact count (valid when isExact)
+  unsigned __int128 exact;
+  /// False if the count overflowed 128 bits
+  bool isExact;
+  /// Base 10 logarithm of the count (-inf when there are no solutions)
+  double log10Count;
+
+  /**
+   * @brief Format the count, exact when possible
+   * @return string decimal count or scientific estimate
+   */
+  string toString() const;
+};
+
+
 /**
  * @brief Constrained Markov Model
  */
@@ -36,7 +57,21 @@ public:
    * @param constraint for NHMM
    * @author Porter Glines 1/13/19
    */
-  void train(MarkovModel model, vector<string> constraint);
+  void train(const MarkovModel &model, vector<string> constraint);
+
+  /**
+   * @brief Build the nodes of a single constraint position without training
+   * 
+   * Applies the constraint rules to one layer only, which lets
+   * callers extend a layered graph one constraint at a time
+   * (see CompileSession)
+   * 
+   * @param model trained markov model to use
+   * @param constraint full constraint sequence
+   * @param layerIndex position to build
+   * @return shared_ptr<Layer> layer with its nodes (no edges)
+   */
+  shared_ptr<Layer> buildConstraintLayer(const MarkovModel &model, const vector<string> &constraint, int layerIndex);
 
   /**
    * @brief Generates a sentence
@@ -55,6 +90,43 @@ public:
    */
   vector<vector<string> > generateSentences(Options options);
 
+  /**
+   * @brief Generates sentences drawn independently from the model
+   * 
+   * Draws all the sentences at once by splitting the count among the
+   * edges of each node (a multinomial draw), so only nodes that
+   * receive a draw are expanded. The sentences are shuffled, which
+   * makes them distributed as independent calls to generateSentence().
+   * 
+   * @param count number of sentences
+   * @return vector<vector<string> > sentences
+   */
+  vector<vector<string> > sampleSentences(int count);
+
+  /**
+   * @brief Generates distinct sentences, sampled without replacement
+   * 
+   * Each sentence is drawn from the probability mass left by the ones
+   * before it (see samplePathsWithoutReplacement()). If the model has
+   * no more solutions than requested, all of them are returned, most
+   * probable first.
+   * 
+   * @param count number of sentences
+   * @return vector<vector<string> > distinct sentences
+   */
+  vector<vector<string> > sampleDistinctSentences(int count);
+
+  /**
+   * @brief Generates the most probable sentences
+   * 
+   * Exact k-best decoding in log space (see findBestPaths())
+   * 
+   * @param count number of sentences
+   * @return vector<vector<string> > sentences by decreasing probability
+   * (fewer if the model has fewer solutions)
+   */
+  vector<vector<string> > generateBestSentences(int count);
+
   /**
    * @brief Get the probability of a specific sentence being generated
    * 
@@ -64,7 +136,34 @@ public:
    * @param sentence generated sentence
    * @return double probability of the given sentence
    */
-  double getSentenceProbability(vector<string> sentence);
+  double getSentenceProbability(const vector<string> &sentence) const;
+
+  /**
+   * @brief Get the log probability of a sentence given by vocabulary IDs
+   * 
+   * Read-only and allocation free, so it may be called from any thread
+   * once the model is trained
+   * 
+   * @param wordIds vocabulary IDs of the sentence's words
+   * @return double natural log probability (-inf if the model cannot
+   * generate the sentence)
+   */
+  double getSentenceLogProbability(const vector<int> &wordIds) const;
+
+  /**
+   * @brief Score many sentences in parallel on the TaskPool
+   * 
+   * @param sentences sentences as vocabulary IDs
+   * @return vector<double> log probability of each sentence (see getSentenceLogProbability())
+   */
+  vector<double> getSentenceLogProbabilities(const vector< vector<int> > &sentences) const;
+
+  /**
+   * @brief Reseed the random generator (for reproducible sampling)
+   * 
+   * @param seed seed value
+   */
+  void setSeed(uint64_t seed) { randGenerator.seed(seed); }
 
   /**
    * @brief Get the length the model has trained on
@@ -86,14 +185,6 @@ public:
    */
   vector<int> getTransitionMatricesSizes();
 
-  /**
-   * @brief Get the Training Sequences object
-   * 
-   * @return vector< vector<string> > training sequences
-   * @author Porter Glines 5/24/19
-   */
-  vector< vector<string> > getTrainingSequences();
-
   /**
    * @brief Get the Markov Order object
    * 
@@ -118,26 +209,69 @@ public:
   /**
    * @brief Get the Total Solution Count of a trained model
    * 
-   * This is a very time consuming depth first search of the model's
-   * structure
+   * Counts the paths from START to the last layer with a backward
+   * dynamic program over the layers, in time linear in the edges
    * 
-   * @return int count of solutions
+   * @return SolutionCount exact count and log scale estimate
    * @author Porter Glines 2/26/20
    */
-  int getTotalSolutionCount();
+  SolutionCount getTotalSolutionCount() const;
 
   /**
-   * @brief 
+   * @brief Sample a word removed by the constraint of a position
    * 
+   * @param layerIndex constraint position
+   * @return string removed word or "" if none
    */
   string sampleRemovedNodeByConstraint(int layerIndex);
 
   /**
-   * @brief 
+   * @brief Sample a word removed by the constraint of a given layer
+   * 
+   * @param layer layer built by this model
+   * @return string removed word or "" if none
+   */
+  string sampleRemovedNodeByConstraint(const Layer &layer);
+
+  /**
+   * @brief Sample words removed by the constraint of a position
+   * 
+   * Each sample is a uniform rank among the removed words, mapped to
+   * its vocabulary ID with a binary search over the kept words
+   * 
+   * @param layerIndex constraint position
+   * @param count number of samples
+   * @return vector<string> removed words ("" if none)
+   */
+  vector<string> sampleRemovedNodesByConstraint(int layerIndex, int count);
+
+  /**
+   * @brief Sample words removed by the constraint of a given layer
+   * 
+   * @param layer layer built by this model
+   * @param count number of samples
+   * @return vector<string> removed words ("" if none)
+   */
+  vector<string> sampleRemovedNodesByConstraint(const Layer &layer, int count);
+
+  /**
+   * @brief Sample a word satisfying the constraint of a position but
+   * removed by arc consistency
    * 
+   * @param layerIndex constraint position
+   * @return string removed word or "" if none
    */
   string sampleRemovedNodeByArcConsistency(int layerIndex);
 
+  /**
+   * @brief Sample words removed by arc consistency at a position
+   * 
+   * @param layerIndex constraint position
+   * @param count number of samples
+   * @return vector<string> removed words ("" if none)
+   */
+  vector<string> sampleRemovedNodesByArcConsistency(int layerIndex, int count);
+
 
 protected:
   /// Marker representing the start of a sentence
@@ -152,34 +286,89 @@ protected:
 
 
   /// Random generator
-  mt19937 randGenerator;
-  /// Random distribution used by the generator
-  uniform_real_distribution<double> randDistribution;
+  RandomGenerator randGenerator;
 
-  /// Transition probability matrices between words
-  vector< unordered_map< string, unordered_map<string, double> > > transitionMatrices;
+  /// Transition layers between words (START layer first once trained)
+  /// Layers may be shared with the LayerCache and are not modified once normalized
+  vector< shared_ptr<Layer> > layers;
 
-  vector< vector<string> > removedNodesbyConstraint;
+  /// Base model the layers are materialized from
+  const MarkovModel *baseModel;
+
+  /**
+   * @brief Materialize a layer from the given vocabulary IDs
+   *
+   * The position's context states ending in the words become the
+   * nodes of layers[layerIndex]. Every other word of the vocabulary
+   * counts as removed by the constraint.
+   *
+   * @param layerIndex layer to materialize
+   * @param wordIds vocabulary IDs of the nodes that satisfy the constraint
+   */
+  void materializeLayer(int layerIndex, const vector<int> &wordIds);
+
+  /**
+   * @brief Make an implicit layer holding every node of the base model
+   * (used for unconstrained positions)
+   *
+   * The layer's nodes and edges are never materialized; arc
+   * consistency and normalization across it use the base model's
+   * transitions directly (see Layer::isWildcard)
+   *
+   * @param layerIndex layer to make
+   */
+  void makeWildcardLayer(int layerIndex);
 
 private:
-  /// Stores training sentences used to train the model
-  vector< vector<string> > trainingSequences;
+  /**
+   * @brief Apply the constraint of one layer
+   * 
+   * Materialize the nodes of layers[layerIndex] that satisfy
+   * the constraint rules (see materializeLayer()).
+   * 
+   * A layer may only depend on the constraint from its own
+   * position onward, since tail layers are reused across
+   * constraints sharing a suffix (see LayerCache)
+   * 
+   * This is a pure virtual function
+   * 
+   * @param constraint full constraint sequence
+   * @param layerIndex layer to materialize
+   */
+  virtual void applyConstraint(const vector<string> &constraint, int layerIndex) = 0;  // TODO: make parameter generic
 
-  /// Original transition probability matrices mapping words -> (word, prob), (word, prob)...
-  unordered_map< string, unordered_map<string, double> > transitionProbs;
+  /**
+   * @brief Apply constraints to the first layers of the transition matrices
+   * 
+   * @param constraint full constraint sequence
+   * @param layerEnd layer past the last layer to materialize
+   */
+  void applyConstraints(const vector<string> &constraint, int layerEnd);
 
-  ///
-  vector< vector<string> > removedNodesbyArcConsistency;
+  /**
+   * @brief Reuse the layers of the longest constraint suffix in the LayerCache
+   * 
+   * @param constraint full constraint sequence
+   * @return int index of the first reused layer (layer count if none)
+   */
+  int reuseCachedLayers(const vector<string> &constraint);
 
   /**
-   * @brief Apply constraints to the transition matrices
+   * @brief Cache the tail layers of every suffix starting before layerEnd
    * 
-   * Modify (delete) nodes int transitionMatrices[] that violate 
-   * the constraint rules.
+   * @param constraint full constraint sequence
+   * @param layerEnd layer past the last newly built layer
+   */
+  void cacheLayers(const vector<string> &constraint, int layerEnd);
+
+  /**
+   * @brief Get the LayerCache key of the constraint suffix starting at a layer
    * 
-   * This is a pure virtual function
+   * @param constraint full constraint sequence
+   * @param layerIndex first layer of the suffix
+   * @return string cache key
    */
-  virtual void applyConstraints(vector<string> constraint) = 0;  // TODO: make parameter generic
+  string getCacheKey(const vector<string> &constraint, int layerIndex);
 
   /**
    * @brief Remove nodes that violate arc consistency
@@ -188,29 +377,96 @@ private:
    * 
    * enforces arc-consistency
    * 
+   * Links every layer to the next one through the base model's
+   * transitions, then counts the live successors of each node.
+   * Nodes without successors are propagated backward through a
+   * worklist using reverse adjacency (AC-4), so every edge is
+   * visited a constant number of times.
+   * 
+   * Only layers before layerEnd are linked and pruned; layers from
+   * layerEnd onward are already consistent.
+   * 
+   * Wildcard layers split the layers into runs that are pruned
+   * back to front, so the layer after each run is already final.
+   * 
+   * @param layerEnd layer past the last layer to prune
    * @author Porter Glines 1/21/19
    */
-  void removeDeadNodes();
+  void removeDeadNodes(int layerEnd);
+
+  /**
+   * @brief Enforce arc consistency on a run of materialized layers
+   * 
+   * @param layerBegin first layer of the run
+   * @param layerEnd layer past the run (already consistent if it exists)
+   */
+  void removeDeadNodes(int layerBegin, int layerEnd);
+
+  /**
+   * @brief Enforce arc consistency on a wildcard layer
+   * 
+   * A word is live if one of its base model successors is live in
+   * the next layer, which must already be consistent
+   * 
+   * @param layerIndex wildcard layer
+   */
+  void removeDeadWildcardNodes(int layerIndex);
+
+  /**
+   * @brief Link layers[layerIndex] to layers[layerIndex+1] with the
+   * base model transitions between their nodes
+   *
+   * @param layerIndex layer to link
+   * @param nextNodeIndices scratch array of size state count, -1 for every entry
+   */
+  void linkLayer(int layerIndex, vector<int> &nextNodeIndices);
 
   /**
    * @brief Adds a transition layer from START to the next layer
-   * should be called after all other layers are settled but not
-   * before the transition matrices are normalized
+   * should be called after all other layers are settled and
+   * normalized; the START layer is normalized separately
    * 
    * @author Porter Glines 1/21/19
    */
   void addStartTransition();
 
   /**
-   * @brief Get the next word in a sentence given the previous word
+   * @brief Get the next node in a sentence given the previous node
    * 
    * Adheres to the markov property
    * 
-   * @param prevWord previous word
-   * @param wordIndex 
-   * @return string next word generated
+   * @param layerIndex layer of the previous node
+   * @param nodeIndex index of the previous node in its layer
+   * @param randVal uniform random value in [0, 1)
+   * @return int index of the next node in layers[layerIndex+1] (-1 if there is none)
+   */
+  int getNextNode(int layerIndex, int nodeIndex, double randVal);
+
+  /**
+   * @brief Split a number of sentences passing through a node among its
+   * edges and recurse into the layers that follow (see sampleSentences())
+   * 
+   * @param layerIndex layer of the node
+   * @param nodeIndex index of the node in its layer
+   * @param count sentences passing through the node
+   * @param path node indices from layers[1] up to the node
+   * @param sentences output sentences
+   */
+  void sampleSentences(int layerIndex, int nodeIndex, int count, vector<int> &path, vector<vector<string> > &sentences);
+
+  /**
+   * @brief Call f(targetIndex, prob) for every edge of a node to the next layer
+   * 
+   * Stored edges are visited as is. Implicit edges (of wildcard layers
+   * and of layers leading into one) are read from the base model and
+   * normalized on the fly. Iteration stops when f returns true.
+   * 
+   * @param layerIndex layer of the node (not the last layer)
+   * @param nodeIndex index of the node in its layer
+   * @param f callback returning true to stop
    */
-  string getNextWord(string prevWord, int wordIndex);
+  template <class F>
+  void forEachEdge(int layerIndex, int nodeIndex, F f) const;
 
   /**
    * @brief Calculate the probability of a sentence
@@ -223,27 +479,19 @@ private:
 
 
   /**
-   * @brief Calculate the frequencies of words
-   * 
-   * The frequencies can be used as the prior probabilities
-   * 
-   * @param sentences training sentences
-   * @return unordered_map<string, int> Frequences map (word, frequency)
-   * @author Porter Glines 1/26/19
-   */
-  unordered_map<string, int> getWordFrequencies(vector< vector<string> > sentences);
-
-  /**
-   * @brief Normalize the transitionMatrices according to the method
+   * @brief Normalize the layers according to the method
    * described by Pachet **CITE
    * 
-   * The normalized transitionMatrices retains the same probability
-   * distribution as the original transitionMatrices but will then
+   * The normalized layers retain the same probability
+   * distribution as the original transition matrices but will then
    * be stochastic (each row adding up to 1.0)
    * 
+   * Layers from layerEnd onward must already be normalized.
+   * 
+   * @param layerEnd layer past the last layer to normalize
    * @author Porter Glines 1/22/19
    */
-  void normalize();
+  void normalize(int layerEnd);
 
   /**
    * @brief Increment the probability in the probability matrix for a word given its next word
@@ -255,29 +503,13 @@ private:
   void increment(unordered_map< string, unordered_map<string, double> > &transitionProbs, string word, string nextWord);
 
   /**
-   * @brief 
-   * 
-   */
-  string sampleRemovedNodes(vector< vector<string> > nodes, int layerIndex);
-
-  /**
-   * @brief 
+   * @brief Sample uniformly random words from a list of removed nodes
    * 
+   * @param nodes vocabulary IDs of removed nodes
+   * @param count number of samples
+   * @return vector<string> removed words ("" if there are none)
    */
-  void initRemovedNodeArrays(int arraySize);
-
-  /**
-   * @brief Get the Total Solution Count of a trained model
-   * 
-   * This is a very time consuming depth first search of the model's
-   * structure
-   * 
-   * @param node Current node
-   * @param matrixIndex Current transition matrix layer
-   * @param count reference to total solution count
-   * @author Porter Glines 2/26/20
-   */
-  void getTotalSolutionCountImpl(string node, int matrixIndex, int& count);
+  vector<string> sampleRemovedNodes(const vector<int> &nodes, int count);
 };
 
 #endif
\ No newline at end of file
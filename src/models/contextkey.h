@@ -0,0 +1,132 @@
+#ifndef CONTEXT_KEY_H
+#define CONTEXT_KEY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+
+/**
+ * @brief Markov context packed as a fixed-width tuple of vocabulary IDs
+ *
+ * IDs are stored oldest first. Contexts shorter than the order (at the
+ * start of a sentence) are padded on the left with START's ID (0),
+ * which never appears inside a sentence.
+ *
+ * @tparam Order number of words in a full context
+ */
+template <int Order>
+struct ContextKey {
+  uint32_t ids[Order];
+
+  /// Empty context (START only)
+  static ContextKey start() {
+    ContextKey key;
+    for (int i = 0; i < Order; i++) {
+      key.ids[i] = 0;
+    }
+    return key;
+  }
+
+  /// Vocabulary ID of the most recent word
+  int last() const { return (int)ids[Order - 1]; }
+
+  /// Vocabulary ID at a position (oldest first, 0 for padding)
+  uint32_t at(int i) const { return ids[i]; }
+
+  /// Number of words in the context (not counting START padding)
+  int length() const {
+    int i = 0;
+    while (i < Order && ids[i] == 0) {
+      i++;
+    }
+    return Order - i;
+  }
+
+  /// Context after appending a word (the oldest word drops off a full context)
+  ContextKey shift(int wordId) const {
+    ContextKey key;
+    for (int i = 0; i < Order - 1; i++) {
+      key.ids[i] = ids[i + 1];
+    }
+    key.ids[Order - 1] = (uint32_t)wordId;
+    return key;
+  }
+
+  bool operator==(const ContextKey &other) const {
+    for (int i = 0; i < Order; i++) {
+      if (ids[i] != other.ids[i]) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  /// Orders by most recent word first, so contexts ending in a word are contiguous
+  bool operator<(const ContextKey &other) const {
+    for (int i = Order - 1; i >= 0; i--) {
+      if (ids[i] != other.ids[i]) {
+        return ids[i] < other.ids[i];
+      }
+    }
+    return false;
+  }
+
+  size_t hash() const {
+    uint64_t h = 0;
+    for (int i = 0; i < Order; i++) {
+      h = (h ^ ids[i]) * 0x9E3779B97F4A7C15ULL;
+    }
+    return (size_t)(h ^ (h >> 32));
+  }
+};
+
+
+/**
+ * @brief Second order contexts fit in a single 64-bit word
+ * (older ID in the high half)
+ */
+template <>
+struct ContextKey<2> {
+  uint64_t packed;
+
+  static ContextKey start() {
+    ContextKey key;
+    key.packed = 0;
+    return key;
+  }
+
+  int last() const { return (int)(uint32_t)packed; }
+
+  uint32_t at(int i) const { return (i == 0) ? (uint32_t)(packed >> 32) : (uint32_t)packed; }
+
+  int length() const { return (packed == 0) ? 0 : ((packed >> 32) == 0 ? 1 : 2); }
+
+  ContextKey shift(int wordId) const {
+    ContextKey key;
+    key.packed = (packed << 32) | (uint32_t)wordId;
+    return key;
+  }
+
+  bool operator==(const ContextKey &other) const { return packed == other.packed; }
+
+  bool operator<(const ContextKey &other) const {
+    uint32_t lastId = (uint32_t)packed;
+    uint32_t otherLastId = (uint32_t)other.packed;
+    return (lastId != otherLastId) ? lastId < otherLastId : (packed >> 32) < (other.packed >> 32);
+  }
+
+  size_t hash() const {
+    uint64_t h = packed * 0x9E3779B97F4A7C15ULL;
+    return (size_t)(h ^ (h >> 32));
+  }
+};
+
+
+namespace std {
+  template <int Order>
+  struct hash< ContextKey<Order> > {
+    size_t operator()(const ContextKey<Order> &key) const { return key.hash(); }
+  };
+}
+
+#endif
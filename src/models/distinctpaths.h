@@ -0,0 +1,142 @@
+#ifndef DISTINCT_PATHS_H
+#define DISTINCT_PATHS_H
+
+#include <vector>
+#include <unordered_map>
+#include <random>
+#include <algorithm>
+
+using namespace std;
+
+
+/**
+ * @brief Sample distinct paths through a layered DAG without replacement
+ *
+ * Each path is drawn from the probability mass not taken by the paths
+ * before it, so the draws never repeat and never need rejecting. The
+ * paths drawn so far form a trie whose nodes track the fraction of
+ * their subtree's mass already taken; a walk weights each edge by its
+ * probability times the untaken fraction of the child it leads to.
+ * A draw costs one walk plus an update of the trie along its path.
+ *
+ * @param layerCount number of layers
+ * @param forEachEdge forEachEdge(layerIndex, nodeIndex, g) calls g(targetIndex, weight)
+ *        for the edges of a node to the next layer; layerIndex -1 is a virtual
+ *        root whose edges enter the first layer. Weights need not be normalized.
+ * @param count number of paths
+ * @param generator random generator
+ * @return vector<vector<int> > node index in each layer of every path
+ * (fewer than count once the graph's mass is exhausted)
+ */
+template <class EdgeFunction, class Generator>
+vector<vector<int> > samplePathsWithoutReplacement(int layerCount, EdgeFunction forEachEdge, int count, Generator &generator) {
+  /// Prefix drawn before; taken is the fraction of its subtree's mass already drawn
+  struct TrieNode {
+    int parent;
+    int node;
+    double prob;
+    double taken;
+    unordered_map<int, int> children;
+  };
+  vector<TrieNode> trie(1);
+  trie[0].parent = -1;
+  trie[0].node = 0;
+  trie[0].prob = 1.0;
+  trie[0].taken = 0.0;
+
+  // Mark a trie node's subtree as fully taken and update the fractions up to the root
+  // (a parent's fraction is the sum of its children's fractions weighted by their probabilities)
+  auto takeSubtree = [&trie](int current) {
+    double delta = 1.0 - trie[current].taken;
+    trie[current].taken = 1.0;
+    for (int node = current; trie[node].parent >= 0; node = trie[node].parent) {
+      delta *= trie[node].prob;
+      TrieNode &parent = trie[trie[node].parent];
+      parent.taken = min(1.0, parent.taken + delta);
+    }
+  };
+
+  uniform_real_distribution<double> uniform(0.0, 1.0);
+  vector<vector<int> > paths;
+  vector<int> targets;
+  vector<double> weights;
+  vector<double> available;
+
+  while ((int)paths.size() < count && layerCount > 0) {
+    vector<int> path;
+    int current = 0;
+    bool isDeadEnd = false;
+
+    for (int i = -1; i < layerCount - 1; i++) {
+      targets.clear();
+      weights.clear();
+      forEachEdge(i, trie[current].node, [&](int target, double weight) {
+        targets.push_back(target);
+        weights.push_back(weight);
+      });
+
+      // Weight edges by the mass left below them
+      const auto &children = trie[current].children;
+      double totalWeight = 0.0;
+      double availableWeight = 0.0;
+      available.resize(weights.size());
+      for (int e = 0; e < (int)weights.size(); e++) {
+        totalWeight += weights[e];
+        double untaken = 1.0;
+        if (!children.empty()) {
+          auto child = children.find(targets[e]);
+          if (child != children.end()) {
+            untaken = max(0.0, 1.0 - trie[child->second].taken);
+          }
+        }
+        available[e] = weights[e] * untaken;
+        availableWeight += available[e];
+      }
+      if (availableWeight <= 0.0) {
+        isDeadEnd = true;
+        break;
+      }
+
+      double randomValue = uniform(generator) * availableWeight;
+      double sum = 0.0;
+      int chosen = -1;
+      for (int e = 0; e < (int)available.size(); e++) {
+        if (available[e] > 0.0) {
+          chosen = e;  // rounding may leave the sum just under randomValue
+          sum += available[e];
+          if (sum > randomValue) {
+            break;
+          }
+        }
+      }
+
+      auto child = trie[current].children.find(targets[chosen]);
+      if (child == trie[current].children.end()) {
+        TrieNode node;
+        node.parent = current;
+        node.node = targets[chosen];
+        node.prob = weights[chosen] / totalWeight;
+        node.taken = 0.0;
+        trie.push_back(move(node));
+        trie[current].children[targets[chosen]] = (int)trie.size() - 1;
+        current = (int)trie.size() - 1;
+      } else {
+        current = child->second;
+      }
+      path.push_back(trie[current].node);
+    }
+    // Nothing is left below the root; rounding may leave mass on a node
+    // whose subtree is already taken, so that node is closed and the draw retried
+    if (isDeadEnd && current == 0) {
+      break;
+    }
+    takeSubtree(current);
+    if (!isDeadEnd) {
+      paths.push_back(move(path));
+    }
+  }
+
+  return paths;
+}
+
+#endif
@@ -0,0 +1,173 @@
+#ifndef K_BEST_PATHS_H
+#define K_BEST_PATHS_H
+
+#include <vector>
+#include <queue>
+#include <unordered_map>
+#include <algorithm>
+#include <cmath>
+
+using namespace std;
+
+
+/**
+ * @brief Path through a layered graph with its log score
+ */
+struct ScoredPath {
+  /// Node index in each layer, first layer first
+  vector<int> nodes;
+  /// Sum of the start score, edge log weights and end score
+  double logScore;
+};
+
+
+/**
+ * @brief Find the highest scoring paths through a layered DAG, best first
+ *
+ * Runs a backward Viterbi pass (the best completion of every node),
+ * then enumerates paths lazily: a partial path only ever proposes its
+ * best extension and, once taken, its next best sibling. Children of a
+ * node are sorted by their best completion the first time the node is
+ * reached. Since the completion scores are exact, every pop extends a
+ * path that is output, so the enumeration costs O(k·L·log(k·L)) on top
+ * of the O(edges) Viterbi pass and the sorting of visited nodes.
+ *
+ * Ties are broken by node index, so results are deterministic.
+ *
+ * @param layerSizes node count of each layer
+ * @param startScores log score of entering each node of the first layer
+ * @param endScore endScore(nodeIndex) log score of leaving a node of the last layer
+ * @param forEachEdge forEachEdge(layerIndex, nodeIndex, g) calls g(targetIndex, logWeight)
+ *        for the edges of a node to the next layer
+ * @param count number of paths (fewer are returned if the graph has fewer)
+ * @return vector<ScoredPath> paths by decreasing score
+ */
+template <class EndFunction, class EdgeFunction>
+vector<ScoredPath> findBestPaths(const vector<int> &layerSizes, const vector<double> &startScores,
+                                 EndFunction endScore, EdgeFunction forEachEdge, int count) {
+  vector<ScoredPath> paths;
+  int layerCount = (int)layerSizes.size();
+  if (layerCount == 0 || count <= 0) {
+    return paths;
+  }
+
+  // Viterbi: best log score from each node to the end
+  vector< vector<double> > best(layerCount);
+  best[layerCount - 1].resize(layerSizes[layerCount - 1]);
+  for (int k = 0; k < layerSizes[layerCount - 1]; k++) {
+    best[layerCount - 1][k] = endScore(k);
+  }
+  for (int i = layerCount - 2; i >= 0; i--) {
+    const vector<double> &nextBest = best[i+1];
+    best[i].assign(layerSizes[i], -INFINITY);
+    for (int k = 0; k < layerSizes[i]; k++) {
+      double &nodeBest = best[i][k];
+      forEachEdge(i, k, [&](int target, double logWeight) {
+        nodeBest = max(nodeBest, logWeight + nextBest[target]);
+      });
+    }
+  }
+
+  /// Extension of a partial path: total (best completion) score, edge score and node
+  struct Child {
+    double total;
+    double logWeight;
+    int node;
+  };
+  auto byTotal = [](const Child &a, const Child &b) {
+    return (a.total != b.total) ? a.total > b.total : a.node < b.node;
+  };
+
+  // Extensions of the empty path enter the first layer
+  vector<Child> rootChildren;
+  for (int k = 0; k < layerSizes[0]; k++) {
+    double total = startScores[k] + best[0][k];
+    if (total > -INFINITY) {
+      rootChildren.push_back({total, startScores[k], k});
+    }
+  }
+  sort(rootChildren.begin(), rootChildren.end(), byTotal);
+
+  // Sorted extensions of reached nodes, built lazily
+  vector< unordered_map<int, vector<Child> > > children(layerCount);
+  auto getChildren = [&](int layerIndex, int nodeIndex) -> const vector<Child> & {
+    auto found = children[layerIndex].find(nodeIndex);
+    if (found != children[layerIndex].end()) {
+      return found->second;
+    }
+    vector<Child> &sorted = children[layerIndex][nodeIndex];
+    const vector<double> &nextBest = best[layerIndex + 1];
+    forEachEdge(layerIndex, nodeIndex, [&](int target, double logWeight) {
+      double total = logWeight + nextBest[target];
+      if (total > -INFINITY) {
+        sorted.push_back({total, logWeight, target});
+      }
+    });
+    sort(sorted.begin(), sorted.end(), byTotal);
+    return sorted;
+  };
+
+  /// Taken partial paths, linked to the partial path they extend
+  struct Prefix {
+    int parent;
+    int node;
+    double logScore;
+  };
+  vector<Prefix> prefixes;
+
+  /// Candidate: the rank-th extension of a prefix (-1 for the empty path) into a layer
+  struct Candidate {
+    double total;
+    long sequence;
+    int parent;
+    int layerIndex;
+    int rank;
+  };
+  auto byPriority = [](const Candidate &a, const Candidate &b) {
+    return (a.total != b.total) ? a.total < b.total : a.sequence > b.sequence;
+  };
+  priority_queue<Candidate, vector<Candidate>, decltype(byPriority)> candidates(byPriority);
+  long sequence = 0;
+
+  auto extensionsOf = [&](int parent, int layerIndex) -> const vector<Child> & {
+    return (parent < 0) ? rootChildren : getChildren(layerIndex - 1, prefixes[parent].node);
+  };
+  auto propose = [&](int parent, int layerIndex, int rank) {
+    const vector<Child> &extensions = extensionsOf(parent, layerIndex);
+    if (rank < (int)extensions.size()) {
+      double prefixScore = (parent < 0) ? 0.0 : prefixes[parent].logScore;
+      candidates.push({prefixScore + extensions[rank].total, sequence++, parent, layerIndex, rank});
+    }
+  };
+
+  propose(-1, 0, 0);
+  while (!candidates.empty() && (int)paths.size() < count) {
+    Candidate candidate = candidates.top();
+    candidates.pop();
+
+    const Child &child = extensionsOf(candidate.parent, candidate.layerIndex)[candidate.rank];
+    double prefixScore = (candidate.parent < 0) ? 0.0 : prefixes[candidate.parent].logScore;
+    prefixes.push_back({candidate.parent, child.node, prefixScore + child.logWeight});
+    int prefix = (int)prefixes.size() - 1;
+
+    propose(candidate.parent, candidate.layerIndex, candidate.rank + 1);
+
+    if (candidate.layerIndex + 1 < layerCount) {
+      propose(prefix, candidate.layerIndex + 1, 0);
+      continue;
+    }
+
+    // Complete path
+    ScoredPath path;
+    path.nodes.resize(layerCount);
+    path.logScore = candidate.total;
+    for (int p = prefix, i = layerCount - 1; p >= 0; p = prefixes[p].parent, i--) {
+      path.nodes[i] = prefixes[p].node;
+    }
+    paths.push_back(move(path));
+  }
+
+  return paths;
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef LAYER_H
+#define LAYER_H
+
+#include <vector>
+#include <stddef.h>
+#include <stdint.h>
+#include <algorithm>
+
+#include "../bitset.h"
+
+using namespace std;
+
+
+/**
+ * @brief Layer of a constrained model's layered graph
+ *
+ * Nodes are context state IDs of the base model (vocabulary IDs for a
+ * first order model, see MarkovModel::getStateWord()); edges are stored
+ * as compressed sparse rows pointing at node indices of the next layer
+ *
+ * A wildcard layer holds every state implicitly: its node indices are
+ * state IDs, only the live nodes and dense sums are kept, and
+ * edges into and out of it are read from the base model (a layer with
+ * empty edgeOffsets has such implicit edges)
+ */
+struct Layer {
+  /// Sorted state IDs of the nodes in the layer
+  vector<int> nodes;
+  /// Edges of node k are [edgeOffsets[k], edgeOffsets[k+1])
+  vector<int> edgeOffsets;
+  /// Node index in the next layer that each edge leads to (sorted per node)
+  vector<int> edgeTargets;
+  /// Transition probability of each edge
+  vector<double> edgeProbs;
+  /// Backward (Pachet) sum of each node, set when the layer is normalized
+  vector<double> sums;
+
+  /// True if the layer implicitly holds every state of its position
+  bool isWildcard = false;
+  /// Live state IDs of a wildcard layer
+  Bitset liveNodes;
+
+  /// Sorted vocabulary IDs that satisfied the layer's constraint (empty if unconstrained)
+  vector<int> constraintNodes;
+  /// Count of words removed by the layer's constraint
+  int removedByConstraintCount = 0;
+  /// Vocabulary IDs of the nodes removed by arc consistency
+  vector<int> removedByArcConsistency;
+
+  /// Node index range (the state count for wildcard layers)
+  int size() const { return isWildcard ? liveNodes.size() : (int)nodes.size(); }
+
+  /// Number of live nodes
+  int liveCount() const { return isWildcard ? liveNodes.count() : (int)nodes.size(); }
+
+  bool isLive(int k) const { return !isWildcard || liveNodes.test(k); }
+
+  /// State ID of node k
+  int nodeId(int k) const { return isWildcard ? k : nodes[k]; }
+
+  /**
+   * @brief Find the node of a state
+   * @param stateId state ID
+   * @return int node index or -1 if the state is not a live node
+   */
+  int indexOf(int stateId) const {
+    if (isWildcard) {
+      return (stateId >= 0 && stateId < liveNodes.size() && liveNodes.test(stateId)) ? stateId : -1;
+    }
+    auto found = lower_bound(nodes.begin(), nodes.end(), stateId);
+    return (found != nodes.end() && *found == stateId) ? (int)(found - nodes.begin()) : -1;
+  }
+
+  /**
+   * @brief Approximate memory used by the layer
+   * @return size_t bytes
+   */
+  size_t byteSize() const {
+    return sizeof(Layer)
+        + (nodes.capacity() + edgeOffsets.capacity() + edgeTargets.capacity()) * sizeof(int)
+        + (constraintNodes.capacity() + removedByArcConsistency.capacity()) * sizeof(int)
+        + (edgeProbs.capacity() + sums.capacity()) * sizeof(double)
+        + (liveNodes.size() + 63) / 64 * sizeof(uint64_t);
+  }
+};
+
+#endif
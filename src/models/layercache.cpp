@@ -0,0 +1,99 @@
+#include "layercache.h"
+
+LayerCache::LayerCache() {
+  this->byteSize = 0;
+  this->capacity = 0;  // Off until setCapacity() (see Options::getLayerCacheSize())
+}
+
+
+LayerCache &LayerCache::getInstance() {
+  static LayerCache instance;
+  return instance;
+}
+
+
+bool LayerCache::find(const string &key, vector< shared_ptr<Layer> > &layers) {
+  lock_guard<mutex> lock(cacheMutex);
+
+  auto found = index.find(key);
+  if (found == index.end()) {
+    return false;
+  }
+
+  // Move to the front (most recently used)
+  entries.splice(entries.begin(), entries, found->second);
+  layers = found->second->layers;
+  return true;
+}
+
+
+void LayerCache::insert(const string &key, const vector< shared_ptr<Layer> > &layers) {
+  lock_guard<mutex> lock(cacheMutex);
+
+  auto found = index.find(key);
+  if (found != index.end()) {
+    erase(found->second);
+  }
+
+  // Layers held by other entries are already charged
+  size_t newByteSize = 0;
+  for (const auto &layer : layers) {
+    if (layerReferences.find(layer.get()) == layerReferences.end()) {
+      newByteSize += layer->byteSize();
+    }
+  }
+  if (newByteSize > capacity) {
+    return;
+  }
+
+  entries.push_front(Entry{key, layers});
+  index[key] = entries.begin();
+  for (const auto &layer : layers) {
+    layerReferences[layer.get()]++;
+  }
+  this->byteSize += newByteSize;
+
+  evict();
+}
+
+
+void LayerCache::setCapacity(size_t bytes) {
+  lock_guard<mutex> lock(cacheMutex);
+  this->capacity = bytes;
+  evict();
+}
+
+
+size_t LayerCache::getCapacity() {
+  lock_guard<mutex> lock(cacheMutex);
+  return this->capacity;
+}
+
+
+void LayerCache::clear() {
+  lock_guard<mutex> lock(cacheMutex);
+  entries.clear();
+  index.clear();
+  layerReferences.clear();
+  byteSize = 0;
+}
+
+
+void LayerCache::evict() {
+  while (byteSize > capacity && !entries.empty()) {
+    erase(prev(entries.end()));
+  }
+}
+
+
+void LayerCache::erase(list<Entry>::iterator entry) {
+  for (const auto &layer : entry->layers) {
+    auto reference = layerReferences.find(layer.get());
+    if (--reference->second == 0) {
+      byteSize -= layer->byteSize();
+      layerReferences.erase(reference);
+    }
+  }
+  index.erase(entry->key);
+  entries.erase(entry);
+}
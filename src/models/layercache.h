@@ -0,0 +1,105 @@
+#ifndef LAYER_CACHE_H
+#define LAYER_CACHE_H
+
+#include <string>
+#include <vector>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+
+#include "layer.h"
+
+using namespace std;
+
+
+/**
+ * @brief Process-wide cache of pruned and normalized layers keyed by
+ * constraint suffix
+ *
+ * Arc consistency and Pachet normalization both run backward from the
+ * last layer, so the layers for positions i..L depend only on the
+ * constraint suffix starting at i. Entries hold those tail layers and
+ * are evicted least recently used first once the capacity is exceeded.
+ * Entries of nested suffixes share their deeper layers; each layer is
+ * charged once, until the last entry holding it is evicted.
+ *
+ * Cached layers are shared between models and are never modified.
+ * The cache is thread safe.
+ */
+class LayerCache {
+public:
+  /**
+   * @brief Get the process-wide cache
+   * @return LayerCache& cache
+   */
+  static LayerCache &getInstance();
+
+  /**
+   * @brief Look up the tail layers of a constraint suffix
+   * @param key suffix key
+   * @param layers set to the cached layers if found
+   * @return true if the key was cached
+   */
+  bool find(const string &key, vector< shared_ptr<Layer> > &layers);
+
+  /**
+   * @brief Cache the tail layers of a constraint suffix
+   *
+   * Only the layers not yet held by another entry are charged
+   *
+   * @param key suffix key
+   * @param layers tail layers (must not be modified afterwards)
+   */
+  void insert(const string &key, const vector< shared_ptr<Layer> > &layers);
+
+  /**
+   * @brief Set the capacity (0 disables the cache)
+   * @param bytes memory budget of the cache
+   */
+  void setCapacity(size_t bytes);
+
+  /**
+   * @brief Get the capacity
+   * @return size_t memory budget of the cache
+   */
+  size_t getCapacity();
+
+  /**
+   * @brief Remove every entry
+   */
+  void clear();
+
+private:
+  LayerCache();
+
+  struct Entry {
+    string key;
+    vector< shared_ptr<Layer> > layers;
+  };
+
+  /// Entries, most recently used first
+  list<Entry> entries;
+  unordered_map<string, list<Entry>::iterator> index;
+  /// Number of entries holding each cached layer
+  unordered_map<const Layer *, int> layerReferences;
+  /// Memory of the distinct cached layers
+  size_t byteSize;
+  size_t capacity;
+  mutex cacheMutex;
+
+  /**
+   * @brief Evict least recently used entries until within capacity
+   * (expects cacheMutex to be held)
+   */
+  void evict();
+
+  /**
+   * @brief Remove an entry and release the layers only it held
+   * (expects cacheMutex to be held)
+   * @param entry entry to remove
+   */
+  void erase(list<Entry>::iterator entry);
+};
+
+#endif
@@ -2,230 +2,767 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <unordered_set>
+#include <iterator>
 #include <random>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <chrono>
 #include <time.h>
+#include <math.h>
 
 #include "../utils.h"
 #include "../options.h"
 #include "../console.h"
 #include "markov.h"
+#include "contextkey.h"
+#include "../taskpool.h"
+#include "../orderedpipeline.h"
+#include "../corpusreader.h"
 
 using namespace std;
 
 // TODO: Templates for non-string use cases
 
+/// Source of unique index IDs
+static atomic<int> nextIndexId(0);
+
+/// Fewest training sentences counted by a worker at a time
+static const int MIN_SENTENCE_RANGE_SIZE = 1 << 14;
+/// Sentence ranges per counting thread
+static const int SENTENCE_RANGES_PER_THREAD = 4;
+
+
+/**
+ * @brief Run work over ranges of items on worker threads
+ *
+ * Results reach the sink in item order, and are merged as sorted
+ * sets or sums, so the counts do not depend on the ranges
+ *
+ * @param itemCount number of items
+ * @param rangeSize items per range
+ * @param threadCount worker threads
+ * @param work Output work(begin, end) over the items [begin, end) (called concurrently)
+ * @param sink void sink(Output &) consumes the result of a range (called on this thread)
+ */
+template <class Output, class Work, class Sink>
+static void forEachRange(int itemCount, int rangeSize, int threadCount, Work work, Sink sink) {
+  int rangeCount = (itemCount + rangeSize - 1) / rangeSize;
+  int nextRange = 0;
+  auto source = [&](int &range) {
+    if (nextRange >= rangeCount) {
+      return false;
+    }
+    range = nextRange++;
+    return true;
+  };
+  auto rangeWork = [&](int &range) {
+    return work(range * rangeSize, min(itemCount, (range + 1) * rangeSize));
+  };
+
+  threadCount = max(1, min(threadCount, rangeCount));
+  OrderedPipeline<int, Output>(threadCount, threadCount * 2).run(source, rangeWork, sink);
+}
+
+
+/**
+ * @brief Get the number of sentences counted by a worker at a time
+ * @param sentenceCount number of sentences
+ * @param threadCount worker threads
+ * @return int sentences per range (a few ranges per thread, at least MIN_SENTENCE_RANGE_SIZE)
+ */
+static int getSentenceRangeSize(int sentenceCount, int threadCount) {
+  int rangeCount = max(1, threadCount) * SENTENCE_RANGES_PER_THREAD;
+  return max(MIN_SENTENCE_RANGE_SIZE, (sentenceCount + rangeCount - 1) / rangeCount);
+}
+
 MarkovModel::MarkovModel() {
   // Initialize random
-  random_device rd;
-  randGenerator = mt19937(rd());
-  randDistribution = uniform_real_distribution<double>(0.0, 1.0);
+  randGenerator = Random::makeGenerator();
 
   this->markovOrder = 0;
-  this->trainingSequences = vector< vector<string> >();
-  this->transitionProbs = unordered_map< string, unordered_map<string, double> >();
+  this->indexId = 0;
+  this->keepTrainingSequences = false;
+  this->threadCount = 1;
 }
 
 
 MarkovModel::MarkovModel(Options options) {
   // Initialize random
-  random_device rd;
-  randGenerator = mt19937(rd());
-  randDistribution = uniform_real_distribution<double>(0.0, 1.0);
+  randGenerator = Random::makeGenerator();
 
   this->markovOrder = 0;
-  this->trainingSequences = vector< vector<string> >();
-  this->transitionProbs = unordered_map< string, unordered_map<string, double> >();
+  this->indexId = 0;
+  this->keepTrainingSequences = false;
+  this->threadCount = options.getIngestThreads();
+  if (this->threadCount <= 0) {
+    this->threadCount = max(1, (int)thread::hardware_concurrency());
+  }
 
   time_t startTime; // used for debug timing
+  // Reading stops once a budget is reached
+  CorpusReader reader(options.getTrainingFilePaths());
+  reader.setLimits(options.getTrainingSentenceLimit(), options.getTrainingTokenLimit(), options.getTrainingByteLimit());
+  string cacheName = reader.getCorpusName().append("m").append(to_string(options.getMarkovOrder())).append("l").append(to_string(options.getTrainingSentenceLimit()));
+  if (options.getTrainingTokenLimit() > 0) {
+    cacheName.append("t").append(to_string(options.getTrainingTokenLimit()));
+  }
+  if (options.getTrainingByteLimit() > 0) {
+    cacheName.append("b").append(to_string(options.getTrainingByteLimit()));
+  }
+  if (options.getKeepTrainingSentences()) {
+    cacheName.append("k");
+  }
+
+  // The update is read first, as the updated model is cached apart from the base model
+  vector< vector<string> > updateSentences;
+  string updateCacheName;
+  if (!options.getUpdateFilePath().empty()) {
+    updateSentences = CorpusReader({options.getUpdateFilePath()}).readSentences(this->threadCount);
+    char hashDigits[17];
+    snprintf(hashDigits, sizeof(hashDigits), "%016llx", (unsigned long long)getUpdateHash(updateSentences));
+    updateCacheName = cacheName + "u" + hashDigits;
+  }
 
     // Read/Pre-process training sequences
   vector< vector<string> > trainingSequences;
   if (options.getUseCache()) {
-    // Read in training sentences from cache
+    // Read in training sentences from cache (the updated model if it was cached)
     startTime = clock();
-    Utils::readFromCache(*this, Utils::getBasename(options.getTrainingFilePath()).append("m").append(to_string(options.getMarkovOrder())).append("l").append(to_string(options.getTrainingSentenceLimit())));
+    if (!updateCacheName.empty() && Utils::isCached(updateCacheName))
+      Utils::readFromCache(*this, updateCacheName);
+    else
+      Utils::readFromCache(*this, cacheName);
     Console::debugPrint("%-35s: %f\n", "Elapsed Time Reading From Cache", (float) (clock() - startTime) / CLOCKS_PER_SEC);
+    Console::debugPrint("%-35s: %d\n", "Cached Updates", (int)this->appliedUpdates.size());
+
+    if (this->isTrained())
+      this->buildIndex();
   }
 
   // TODO: Rebuild cache reading it fails or if markov order is different
   // Read/Process/Train model
-  if (this->getProbabilityMatrix().empty()){
+  if (!this->isTrained()){
     if (options.getUseCache())
       Console::debugPrint("No cache found for file.\n");
 
-    // Read in training sentences
-    startTime = clock();
-    string trainingText = Utils::readInTrainingSentences(options.getTrainingFilePath());
-    Console::debugPrint("%-35s: %f\n", "Elapsed Time Reading Data", (float) (clock() - startTime) / CLOCKS_PER_SEC);
-
-    // Process training sentences
-    startTime = clock();
-    trainingSequences = Utils::processTrainingSentences(trainingText, options.getTrainingSentenceLimit(), options.getMarkovOrder());
-    Console::debugPrint("%-35s: %f\n", "Elapsed Time Processing Data", (float) (clock() - startTime) / CLOCKS_PER_SEC);
+    // Read and process training sentences (chunks are tokenized in parallel, so timed by wall clock)
+    auto wallStartTime = chrono::steady_clock::now();
+    trainingSequences = reader.readSentences(this->threadCount);
+    Console::debugPrint("%-35s: %d\n", "Training Files", (int)reader.getFilePaths().size());
+    Console::debugPrint("%-35s: %ld\n", "Training Bytes Read", reader.getBytesRead());
+    Console::debugPrint("%-35s: %f\n", "Elapsed Time Processing Data", chrono::duration<double>(chrono::steady_clock::now() - wallStartTime).count());
 
-    this->train(trainingSequences, options.getMarkovOrder());
+    wallStartTime = chrono::steady_clock::now();
+    this->train(move(trainingSequences), options.getMarkovOrder(), options.getKeepTrainingSentences());
+    Console::debugPrint("%-35s: %f\n", "Elapsed Time Counting", chrono::duration<double>(chrono::steady_clock::now() - wallStartTime).count());
 
     if (options.getUseCache())
-      // Write to cache
-      Utils::writeToCache(this, Utils::getBasename(options.getTrainingFilePath()).append("m").append(to_string(options.getMarkovOrder())).append("l").append(to_string(options.getTrainingSentenceLimit())));
+      Utils::writeToCache(*this, cacheName);
+  }
+
+  // Add the update text on top of the trained model
+  if (!updateCacheName.empty()) {
+    startTime = clock();
+    bool isApplied = this->applyUpdate(updateSentences);
+    Console::debugPrint("%-35s: %f\n", "Elapsed Time Updating", (float) (clock() - startTime) / CLOCKS_PER_SEC);
+
+    if (!isApplied) {
+      Console::debugPrint("Update was already applied.\n");
+    } else if (options.getUseCache()) {
+      // Cached under the name of the update; the base model's cache is left as is
+      Utils::writeToCache(*this, updateCacheName);
+    }
   }
+
+  Console::debugPrint("%-35s: %d\n", "Context State Count", this->getStateCount());
 }
 
 
-void MarkovModel::train(vector< vector<string> > trainingSequences, int markovOrder) {
+void MarkovModel::train(vector< vector<string> > trainingSequences, int markovOrder, bool keepTrainingSequences) {
 
+  if (markovOrder < 1 || markovOrder > MAX_MARKOV_ORDER) {
+    printf("WARNING::Markov order %d is not supported, using %d.\n", markovOrder, max(1, min(markovOrder, (int)MAX_MARKOV_ORDER)));
+    markovOrder = max(1, min(markovOrder, (int)MAX_MARKOV_ORDER));
+  }
   this->markovOrder = markovOrder;  // default parameter = 1
-  this->trainingSequences = trainingSequences;
+  this->keepTrainingSequences = keepTrainingSequences;
 
   // Clear model data structures
-  transitionProbs.clear();
+  vocabulary.clear();
+  vocabularyIds.clear();
+  wordFrequencies.clear();
+  contextWords.clear();
+  transitionOffsets.clear();
+  transitionTargets.clear();
+  transitionCounts.clear();
+  appliedUpdates.clear();
+
+  // Counts stay raw; probabilities are count / row total
+  vector<int> newIds = this->addVocabulary(trainingSequences);
+  this->addCounts(trainingSequences, newIds);
+  this->trainingSequences.clear();
+  if (keepTrainingSequences) {
+    this->trainingSequences = move(trainingSequences);
+  }
+
+  this->buildIndex();
+}
 
-  // iterate over sentences
-  for (vector<string> sentence : trainingSequences) {
-    // iterate over sentence words
-    for (int i = 0; i < sentence.size(); i++) {
-      string prevWord = (i == 0) ? START : sentence[i - 1];
-      string currWord = sentence[i];
 
-      this->increment(transitionProbs, prevWord, currWord);
+void MarkovModel::update(const vector< vector<string> > &sentences) {
+  if (!isTrained()) {
+    this->train(sentences, max(1, this->markovOrder), this->keepTrainingSequences);
+    return;
+  }
+
+  vector<int> newIds = this->addVocabulary(sentences);
+  this->addCounts(sentences, newIds);
+  if (keepTrainingSequences) {
+    this->trainingSequences.insert(this->trainingSequences.end(), sentences.begin(), sentences.end());
+  }
+
+  this->buildIndex();
+}
+
+
+uint64_t MarkovModel::getUpdateHash(const vector< vector<string> > &sentences) {
+  uint64_t hash = Utils::hashText("");
+  for (const auto &sentence : sentences) {
+    for (const auto &word : sentence) {
+      hash = Utils::hashText(word + " ", hash);
     }
-    if (!sentence.empty()) {
-      this->increment(transitionProbs, sentence[sentence.size() - 1], END);
+    hash = Utils::hashText("\n", hash);
+  }
+  return hash;
+}
+
+
+bool MarkovModel::applyUpdate(const vector< vector<string> > &sentences) {
+  uint64_t hash = getUpdateHash(sentences);
+  if (find(appliedUpdates.begin(), appliedUpdates.end(), hash) != appliedUpdates.end()) {
+    return false;
+  }
+
+  this->update(sentences);
+  appliedUpdates.push_back(hash);
+  return true;
+}
+
+
+vector<int> MarkovModel::addVocabulary(const vector< vector<string> > &sentences) {
+  if (vocabulary.empty()) {
+    vocabulary.push_back(START);
+    vocabulary.push_back(END);
+  }
+  vector<int> newIds(vocabulary.size());
+  for (int id = 0; id < (int)vocabulary.size(); id++) {
+    newIds[id] = id;
+  }
+
+  // New words of each range, deduplicated again once merged
+  vector<string> words;
+  auto work = [&](int begin, int end) {
+    unordered_set<string> rangeWords;
+    for (int s = begin; s < end; s++) {
+      for (const auto &word : sentences[s]) {
+        if (vocabularyIds.find(word) == vocabularyIds.end()) {
+          rangeWords.insert(word);
+        }
+      }
+    }
+    return vector<string>(rangeWords.begin(), rangeWords.end());
+  };
+  auto sink = [&](vector<string> &rangeWords) {
+    words.insert(words.end(), make_move_iterator(rangeWords.begin()), make_move_iterator(rangeWords.end()));
+  };
+  int sentenceCount = (int)sentences.size();
+  forEachRange< vector<string> >(sentenceCount, getSentenceRangeSize(sentenceCount, threadCount), threadCount, work, sink);
+  sort(words.begin(), words.end());
+  words.erase(unique(words.begin(), words.end()), words.end());
+  if (words.empty() && !vocabularyIds.empty()) {
+    return newIds;
+  }
+
+  // Merge the new words into the sorted words (existing IDs keep their order)
+  vector<string> merged;
+  merged.reserve(vocabulary.size() + words.size());
+  merged.push_back(START);
+  merged.push_back(END);
+  auto word = words.begin();
+  for (int id = FIRST_WORD_ID; id < (int)vocabulary.size(); id++) {
+    for (; word != words.end() && *word < vocabulary[id]; word++) {
+      merged.push_back(*word);
     }
+    newIds[id] = (int)merged.size();
+    merged.push_back(vocabulary[id]);
   }
+  merged.insert(merged.end(), word, words.end());
+  vocabulary.swap(merged);
 
-  // Normalize all probabilities from 0.0-1.0
-  for (auto &pairInnerMap : transitionProbs) {
-      this->normalize(pairInnerMap.second);
+  vocabularyIds.clear();
+  vocabularyIds.reserve(vocabulary.size());
+  for (int id = 0; id < (int)vocabulary.size(); id++) {
+    vocabularyIds.emplace(vocabulary[id], id);
   }
+  return newIds;
 }
 
 
-void MarkovModel::increment(unordered_map< string, unordered_map<string, double> > &transitionProbs, string word, const string& nextWord) {
+void MarkovModel::addCounts(const vector< vector<string> > &sentences, const vector<int> &newIds) {
+  // Unigram frequencies by vocabulary ID (the START prior of constrained models);
+  // the new words are counted with the transitions
+  vector<uint32_t> frequencies(vocabulary.size(), 0);
+  for (int id = 0; id < (int)wordFrequencies.size(); id++) {
+    frequencies[newIds[id]] = wordFrequencies[id];
+  }
+  wordFrequencies.swap(frequencies);
 
-  auto transition = transitionProbs.emplace(word, unordered_map<string, double>());
-  unordered_map<string, double> *innerMap = &transition.first->second;
+  switch (markovOrder) {
+    case 2: addContextCounts<2>(sentences, newIds); break;
+    case 3: addContextCounts<3>(sentences, newIds); break;
+    case 4: addContextCounts<4>(sentences, newIds); break;
+    default: addContextCounts<1>(sentences, newIds); break;
+  }
+}
+
+
+template <int Order>
+void MarkovModel::addContextCounts(const vector< vector<string> > &sentences, const vector<int> &newIds) {
+  typedef ContextKey<Order> Key;
+  int size = (int)vocabulary.size();
+  int oldSize = (int)newIds.size();
+  int oldStateCount = transitionOffsets.empty() ? 0 : (int)transitionOffsets.size() - 1;
+
+  // START, END and single-word contexts keep their vocabulary IDs;
+  // longer contexts follow by length, then by last word
+  auto isBefore = [](const Key &a, const Key &b) {
+    return (a.length() != b.length()) ? a.length() < b.length() : a < b;
+  };
+
+  // Every (context, next word) occurrence of a range, for contexts of each length up to
+  // the order, with the range's word frequencies and sorted long contexts.
+  // Short contexts are counted at every position, so the first words of a generated
+  // sentence need not open a training sentence (as with the unigram START prior)
+  struct RangeOccurrences {
+    vector< pair<Key, int> > occurrences;
+    vector<uint32_t> frequencies;
+    vector<Key> contexts;
+  };
+  vector< vector< pair<Key, int> > > occurrences;
+  vector<Key> newContexts;
+  auto countOccurrences = [&](int begin, int end) {
+    RangeOccurrences range;
+    range.frequencies.assign(size, 0);
+    vector<int> ids;
+    for (int s = begin; s < end; s++) {
+      ids.clear();
+      for (const auto &word : sentences[s]) {
+        ids.push_back(vocabularyIds.at(word));
+        range.frequencies[ids.back()]++;
+      }
+      if (ids.empty()) {
+        continue;
+      }
+
+      range.occurrences.emplace_back(Key::start(), ids[0]);
+      for (int j = 0; j < (int)ids.size(); j++) {
+        int next = (j + 1 < (int)ids.size()) ? ids[j + 1] : END_ID;
+        for (int length = 1; length <= Order && j - length + 1 >= 0; length++) {
+          Key key = Key::start();
+          for (int t = j - length + 1; t <= j; t++) {
+            key = key.shift(ids[t]);
+          }
+          range.occurrences.emplace_back(key, next);
+          if (length > 1) {
+            range.contexts.push_back(key);
+          }
+        }
+      }
+    }
+    sort(range.contexts.begin(), range.contexts.end(), isBefore);
+    range.contexts.erase(unique(range.contexts.begin(), range.contexts.end()), range.contexts.end());
+    return range;
+  };
+  auto mergeOccurrences = [&](RangeOccurrences &range) {
+    for (int id = 0; id < size; id++) {
+      wordFrequencies[id] += range.frequencies[id];
+    }
+    newContexts.insert(newContexts.end(), range.contexts.begin(), range.contexts.end());
+    occurrences.push_back(move(range.occurrences));
+  };
+  int sentenceCount = (int)sentences.size();
+  forEachRange<RangeOccurrences>(sentenceCount, getSentenceRangeSize(sentenceCount, threadCount), threadCount, countOccurrences, mergeOccurrences);
+  sort(newContexts.begin(), newContexts.end(), isBefore);
+  newContexts.erase(unique(newContexts.begin(), newContexts.end()), newContexts.end());
+
+  // Previous long contexts with their words' new IDs (the remap keeps their order)
+  vector<Key> oldContexts(max(0, oldStateCount - oldSize));
+  for (int k = 0; k < (int)oldContexts.size(); k++) {
+    Key key = Key::start();
+    for (int i = 0; i < Order; i++) {
+      key = key.shift(newIds[contextWords[(size_t)k * Order + i]]);
+    }
+    oldContexts[k] = key;
+  }
+
+  vector<Key> longContexts;
+  longContexts.reserve(oldContexts.size() + newContexts.size());
+  set_union(oldContexts.begin(), oldContexts.end(), newContexts.begin(), newContexts.end(), back_inserter(longContexts), isBefore);
+  vector<Key>().swap(newContexts);
 
-  auto foundProb = innerMap->find(nextWord);
-  if (foundProb != innerMap->end()) {
-    foundProb->second += 1.0;
-  } else {
-    innerMap->insert(make_pair(nextWord, 1.0));
+  auto getStateId = [&](const Key &key) {
+    int length = key.length();
+    if (length <= 1) {
+      return (length == 0) ? (int)START_ID : key.last();
+    }
+    return size + (int)(lower_bound(longContexts.begin(), longContexts.end(), key, isBefore) - longContexts.begin());
+  };
+
+  // New state ID of each previous state, and the reverse (-1 for new states)
+  int stateCount = size + (int)longContexts.size();
+  vector<int> newStateIds(oldStateCount);
+  vector<int> oldStateIds(stateCount, -1);
+  for (int stateId = 0; stateId < oldStateCount; stateId++) {
+    newStateIds[stateId] = (stateId < oldSize) ? newIds[stateId] : getStateId(oldContexts[stateId - oldSize]);
+    oldStateIds[newStateIds[stateId]] = stateId;
+  }
+
+  // Count the new transitions between states of each range, then sum them by (state, target)
+  struct Transition {
+    int source;
+    int target;
+    uint32_t count;
+
+    bool operator<(const Transition &other) const {
+      return (source != other.source) ? source < other.source : target < other.target;
+    }
+  };
+  auto countTransitions = [&](int begin, int end) {
+    vector<Transition> counted;
+    for (int r = begin; r < end; r++) {
+      vector<Transition> transitions;
+      transitions.reserve(occurrences[r].size());
+      for (const auto &occurrence : occurrences[r]) {
+        int target = (occurrence.second == END_ID) ? END_ID : getStateId(occurrence.first.shift(occurrence.second));
+        transitions.push_back({getStateId(occurrence.first), target, 1});
+      }
+      vector< pair<Key, int> >().swap(occurrences[r]);
+      sort(transitions.begin(), transitions.end());
+      for (const auto &transition : transitions) {
+        if (!counted.empty() && !(counted.back() < transition)) {
+          counted.back().count++;
+        } else {
+          counted.push_back(transition);
+        }
+      }
+    }
+    return counted;
+  };
+  vector<Transition> transitions;
+  auto mergeTransitions = [&](vector<Transition> &counted) {
+    transitions.insert(transitions.end(), counted.begin(), counted.end());
+  };
+  forEachRange< vector<Transition> >((int)occurrences.size(), 1, threadCount, countTransitions, mergeTransitions);
+  sort(transitions.begin(), transitions.end());
+
+  // Merge the new transitions into the previous rows. Remapped states keep
+  // their order, so rows without new transitions are copied as they are
+  vector<int> offsets(1, 0);
+  vector<int> targets;
+  vector<uint32_t> counts;
+  offsets.reserve(stateCount + 1);
+  targets.reserve(transitionTargets.size() + transitions.size());
+  counts.reserve(transitionCounts.size() + transitions.size());
+  size_t t = 0;
+  for (int stateId = 0; stateId < stateCount; stateId++) {
+    int oldStateId = oldStateIds[stateId];
+    int e = (oldStateId >= 0) ? transitionOffsets[oldStateId] : 0;
+    int rowEnd = (oldStateId >= 0) ? transitionOffsets[oldStateId + 1] : 0;
+
+    while (e < rowEnd || (t < transitions.size() && transitions[t].source == stateId)) {
+      int oldTarget = (e < rowEnd) ? newStateIds[transitionTargets[e]] : stateCount;
+      int newTarget = (t < transitions.size() && transitions[t].source == stateId) ? transitions[t].target : stateCount;
+      int target = min(oldTarget, newTarget);
+
+      uint32_t count = 0;
+      if (oldTarget == target) {
+        count += transitionCounts[e++];
+      }
+      for (; t < transitions.size() && transitions[t].source == stateId && transitions[t].target == target; t++) {
+        count += transitions[t].count;
+      }
+      targets.push_back(target);
+      counts.push_back(count);
+    }
+    offsets.push_back((int)targets.size());
+  }
+
+  transitionOffsets.swap(offsets);
+  transitionTargets.swap(targets);
+  transitionCounts.swap(counts);
+
+  // States are contiguous by context length and, within a length, by last word
+  stateWords.resize(stateCount);
+  for (int id = 0; id < size; id++) {
+    stateWords[id] = id;
+  }
+  contextWords.resize(longContexts.size() * Order);
+  for (int k = 0; k < (int)longContexts.size(); k++) {
+    stateWords[size + k] = longContexts[k].last();
+    for (int i = 0; i < Order; i++) {
+      contextWords[(size_t)k * Order + i] = longContexts[k].at(i);
+    }
+  }
+
+  contextLengthBegins.assign(Order + 1, stateCount);
+  contextLengthBegins[0] = FIRST_WORD_ID;
+  for (int k = (int)longContexts.size() - 1; k >= 0; k--) {
+    contextLengthBegins[longContexts[k].length() - 1] = size + k;
+  }
+  for (int length = Order - 1; length >= 1; length--) {
+    contextLengthBegins[length] = min(contextLengthBegins[length], contextLengthBegins[length + 1]);
   }
 }
 
 
-void MarkovModel::normalize(unordered_map<string, double> &map) {
-  double sum = 0.0;
-  for (const auto &pair : map) {
-    sum += pair.second;
+void MarkovModel::buildIndex() {
+  this->indexId = ++nextIndexId;
+  int size = (int)vocabulary.size();
+  int order = max(1, markovOrder);
+
+  // Offsets of the states ending in each word, per context length
+  wordStateOffsets.assign(order, vector<int>(size + 1, 0));
+  for (int length = 1; length <= order; length++) {
+    vector<int> &offsets = wordStateOffsets[length - 1];
+    for (int stateId = contextLengthBegins[length - 1]; stateId < contextLengthBegins[length]; stateId++) {
+      offsets[stateWords[stateId] + 1]++;
+    }
+    offsets[0] = contextLengthBegins[length - 1];
+    for (int id = 0; id < size; id++) {
+      offsets[id + 1] += offsets[id];
+    }
+  }
+
+  // Row totals turn counts into probabilities
+  rowTotals.assign(stateWords.size(), 0);
+  for (int stateId = 0; stateId < (int)stateWords.size(); stateId++) {
+    for (int e = transitionOffsets[stateId]; e < transitionOffsets[stateId + 1]; e++) {
+      rowTotals[stateId] += transitionCounts[e];
+    }
+  }
+
+  // Words are sorted, so each bucket is filled in sorted ID order
+  firstLetterBuckets.assign(256, vector<int>());
+  for (int id = FIRST_WORD_ID; id < (int)vocabulary.size(); id++) {
+    firstLetterBuckets[(unsigned char)vocabulary[id][0]].push_back(id);
+  }
+
+  // Precompute unary attributes once per vocabulary entry
+  wordAttributes.assign(size, WordAttributes());
+  wordBits = Bitset(size);
+  firstLetterBits.assign(256, Bitset());
+  minLengthBits.assign(MAX_TRACKED_LENGTH + 1, Bitset(size));
+  stopWordBits = Bitset(size);
+  endsSentenceBits = Bitset(size);
+  emptyBits = Bitset(size);
+
+  for (int letter = 0; letter < 256; letter++) {
+    if (!firstLetterBuckets[letter].empty()) {
+      firstLetterBits[letter] = Bitset(size);
+    }
+  }
+
+  for (int id = FIRST_WORD_ID; id < size; id++) {
+    const string &word = vocabulary[id];
+
+    WordAttributes *attributes = &wordAttributes[id];
+    attributes->firstLetter = (unsigned char)word[0];
+    attributes->length = (unsigned char)min((int)word.size(), 255);
+    attributes->isStopWord = Utils::isStopWord(word);
+    // A word's own state counts every word that follows it, and rows are sorted (END first)
+    attributes->endsSentence = getTransitionEnd(id) > getTransitionBegin(id) && transitionTargets[getTransitionBegin(id)] == END_ID;
+
+    wordBits.set(id);
+    firstLetterBits[attributes->firstLetter].set(id);
+    for (int length = 0; length <= min((int)attributes->length, (int)MAX_TRACKED_LENGTH); length++) {
+      minLengthBits[length].set(id);
+    }
+    stopWordBits.set(id, attributes->isStopWord);
+    endsSentenceBits.set(id, attributes->endsSentence);
+  }
+}
+
+
+const Bitset &MarkovModel::getFirstLetterBits(char letter) const {
+  const Bitset &bits = firstLetterBits[(unsigned char)letter];
+  return (bits.size() == 0) ? emptyBits : bits;
+}
+
+
+const Bitset &MarkovModel::getMinLengthBits(int length) const {
+  return minLengthBits[max(0, min(length, (int)MAX_TRACKED_LENGTH))];
+}
+
+
+int MarkovModel::getWordId(const string &word) const {
+  auto found = vocabularyIds.find(word);
+  return (found != vocabularyIds.end()) ? found->second : -1;
+}
+
+
+vector<int> MarkovModel::getWordIds(const vector<string> &words) const {
+  vector<int> wordIds(words.size());
+  for (int i = 0; i < (int)words.size(); i++) {
+    wordIds[i] = getWordId(words[i]);
   }
+  return wordIds;
+}
 
-  for (const auto &pair : map) {
-    map[pair.first] = map[pair.first] / sum;
+
+double MarkovModel::getTransitionProbability(const string &word, const string &nextWord) const {
+  // A word's own state and START count every following word, like a first order model
+  int stateId = (word == START) ? START_ID : getWordId(word);
+  int nextId = (nextWord == END) ? END_ID : getWordId(nextWord);
+  if (stateId < 0 || stateId == END_ID || nextId < END_ID || !isTrained()) {
+    return 0.0;
+  }
+
+  int statesBegin = (nextId == END_ID) ? END_ID : getWordStatesBegin(nextId, (stateId == START_ID) ? 0 : 1);
+  int statesEnd = (nextId == END_ID) ? END_ID + 1 : getWordStatesEnd(nextId, (stateId == START_ID) ? 0 : 1);
+  auto rowBegin = transitionTargets.begin() + getTransitionBegin(stateId);
+  auto rowEnd = transitionTargets.begin() + getTransitionEnd(stateId);
+  auto target = lower_bound(rowBegin, rowEnd, statesBegin);
+  if (target == rowEnd || *target >= statesEnd) {
+    return 0.0;
   }
+  return getTransitionProbability(stateId, (int)(target - transitionTargets.begin()));
 }
 
 
 vector<string> MarkovModel::generateSentence(int length) {
 
-  if (transitionProbs.empty()) {
+  if (!isTrained()) {
     printf("ERROR::Model is not trained.\n");  // TODO: throw error
     return vector<string>();
   }
 
   vector<string> sentence;
 
-  string nextWord = getNextWord(START);
-  sentence.push_back(nextWord);
-
-  string prevWord = nextWord;
-  for (int i = 1; i < length; i++) {
-    nextWord = getNextWord(prevWord);
-    sentence.push_back(nextWord);
-    prevWord = nextWord;
+  // Follow the context states, so higher orders condition on the last markovOrder words
+  int stateId = START_ID;
+  for (int i = 0; i < length; i++) {
+    stateId = getNextState(stateId);
+    sentence.push_back((stateId >= 0) ? vocabulary[stateWords[stateId]] : "");
   }
 
   return sentence;
 }
 
 
-double MarkovModel::getSentenceProbability(vector<string> sentence) {
+double MarkovModel::getSentenceProbability(const vector<string> &sentence) const {
   double prob = 1.0;
 
-  string currWord;
-  string nextWord;
+  int stateId = START_ID;
+  for (int i = 0; i < (int)sentence.size(); i++) {
+    int wordId = getWordId(sentence[i]);
+    int e = (wordId >= FIRST_WORD_ID) ? findTransition(stateId, wordId, i) : -1;
 
-  for (int i = 0; i < sentence.size(); i++) {
-    if (i == 0) {
-      currWord = START;
-      nextWord = sentence[i];
-    } else {
-      currWord = sentence[i-1];
-      nextWord = sentence[i];
+    // Unseen transitions are skipped, and the context restarts at the word
+    if (e < 0) {
+      stateId = (wordId >= FIRST_WORD_ID) ? wordId : START_ID;
+      continue;
     }
-
-    double p = this->transitionProbs[currWord][nextWord];
-    if (p != 0)
-        prob *= p;
+    prob *= getTransitionProbability(stateId, e);
+    stateId = transitionTargets[e];
   }
   return prob;
 }
 
 
-string MarkovModel::getNextWord(const string& prevWord) {
-  unordered_map<string, double> map = this->transitionProbs[prevWord];
-  double randVal = randDistribution(randGenerator);
+double MarkovModel::getSentenceLogProbability(const vector<int> &wordIds) const {
+  double logProb = 0.0;
 
-  double sum = 0.0;
-  for (const auto &pair : map) {
-    sum += map[pair.first];
+  int stateId = START_ID;
+  for (int i = 0; i < (int)wordIds.size(); i++) {
+    int wordId = wordIds[i];
+    if (wordId < FIRST_WORD_ID || wordId >= (int)vocabulary.size()) {
+      return -INFINITY;
+    }
 
-    if (sum > randVal) {
-      return pair.first;
+    int e = findTransition(stateId, wordId, i);
+    if (e < 0) {
+      return -INFINITY;
     }
+
+    logProb += log(getTransitionProbability(stateId, e));
+    stateId = transitionTargets[e];
   }
-  return "";  // TODO: throw error
+  return logProb;
 }
 
 
-double MarkovModel::calculateProbability(vector<string> sentence) {
-  double prob = 1.0;
-  for (int i = 0; i < sentence.size(); i++) {
-    string prevWord;
-    if (i == 0) {
-      prevWord = START;
-    } else {
-      prevWord = sentence[i-1];
-    }
+int MarkovModel::findTransition(int stateId, int wordId, int position) const {
+  // Rows are sorted by target, and the states ending in the word are contiguous
+  int statesBegin = getWordStatesBegin(wordId, position);
+  int statesEnd = getWordStatesEnd(wordId, position);
+  auto rowBegin = transitionTargets.begin() + getTransitionBegin(stateId);
+  auto rowEnd = transitionTargets.begin() + getTransitionEnd(stateId);
+  auto target = lower_bound(rowBegin, rowEnd, statesBegin);
+  if (target == rowEnd || *target >= statesEnd) {
+    return -1;
+  }
+  return (int)(target - transitionTargets.begin());
+}
 
-    string currWord = sentence[i];
 
-    prob *= transitionProbs[prevWord][currWord];
-  }
-  return prob;
+vector<double> MarkovModel::getSentenceLogProbabilities(const vector< vector<int> > &sentences) const {
+  vector<double> logProbs(sentences.size());
+  TaskPool::getInstance().parallelFor(0, (int)sentences.size(), 64, [&](int begin, int end) {
+    for (int i = begin; i < end; i++) {
+      logProbs[i] = getSentenceLogProbability(sentences[i]);
+    }
+  });
+  return logProbs;
 }
 
 
-unordered_map<string, int> MarkovModel::getWordFrequencies(vector< vector<string> > sentences) {
-  unordered_map<string, int> frequencies;
+int MarkovModel::getNextState(int stateId) {
+  if (stateId < 0 || getTransitionEnd(stateId) == getTransitionBegin(stateId)) {
+    return -1;  // TODO: throw error
+  }
+  double randVal = randGenerator.nextDouble() * rowTotals[stateId];
 
-  for (const auto &sentence : sentences) {
-    for (const auto &word : sentence) {
-      frequencies[word]++;
+  double sum = 0.0;
+  for (int e = getTransitionBegin(stateId); e < getTransitionEnd(stateId); e++) {
+    sum += transitionCounts[e];
+
+    if (sum > randVal) {
+      return transitionTargets[e];
     }
   }
-  return frequencies;
+  return -1;  // TODO: throw error
+}
+
+
+double MarkovModel::calculateProbability(vector<string> sentence) {
+  return exp(getSentenceLogProbability(getWordIds(sentence)));
 }
 
 
 void MarkovModel::printTransitionProbs() {
-  for (const auto &firstWord : this->transitionProbs) {
-    printf("%20s >>> ", firstWord.first.c_str());
+  // Rows of single words (and START), like a first order model
+  for (int stateId = 0; stateId < (int)vocabulary.size(); stateId++) {
+    if (stateId == END_ID) {
+      continue;
+    }
+    printf("%20s >>> ", vocabulary[stateId].c_str());
     double sum = 0.0;
-    for (const auto &nextWord : firstWord.second) {
-      printf("%s:(%0.3f) ", nextWord.first.c_str(), nextWord.second);
-      sum += nextWord.second;
+    for (int e = getTransitionBegin(stateId); e < getTransitionEnd(stateId); e++) {
+      double prob = getTransitionProbability(stateId, e);
+      printf("%s:(%0.3f) ", vocabulary[stateWords[transitionTargets[e]]].c_str(), prob);
+      sum += prob;
     }
     printf(" sum: >%f<", sum);
     printf("\n");
@@ -4,14 +4,35 @@
 #include <string>
 #include <vector>
 #include <unordered_map>
+#include <stdint.h>
 #include <random>
+#include <algorithm>
 #include <boost/serialization/access.hpp>
+#include <boost/serialization/split_member.hpp>
+#include <boost/serialization/version.hpp>
 
 #include "../options.h"
+#include "../bitset.h"
+#include "../random.h"
 
 using namespace std;
 
 
+/**
+ * @brief Packed unary attributes of a vocabulary word
+ */
+struct WordAttributes {
+  /// First character of the word
+  unsigned char firstLetter;
+  /// Character count of the word (saturates at 255)
+  unsigned char length;
+  /// Word is a stop word (see Utils::isStopWord())
+  bool isStopWord;
+  /// Word is followed by END in the training sentences
+  bool endsSentence;
+};
+
+
 /**
  * @brief Markov Model
  */
@@ -28,17 +49,63 @@ public:
    * @brief Train the markov model using training sentences
    * 
    * Reads in the training text at the given filePath and increments
-   * the transition probabilities while iterating over words.
+   * the transition counts while iterating over words. Counts are kept
+   * raw; probabilities are derived from them on use (count over row total).
+   * 
+   * Higher orders keep a sliding window of the last markovOrder
+   * words as the context state (see getStateWord())
+   * 
+   * The sentences are only retained if asked for (see getTrainingSequences());
+   * the counts and the unigram table are all the models need
    * 
    * @param trainingSequences vector of sentences to train on
-   * @param markovOrder specifies the markov order of the model (the lookahead distance)
+   * @param markovOrder specifies the markov order of the model (the lookahead distance, at most MAX_MARKOV_ORDER)
+   * @param keepTrainingSequences retain the sentences (and those of later updates)
    * @author Porter Glines 1/13/19
    */
-  void train(vector< vector<string> > trainingSequences, int markovOrder = 1);
+  void train(vector< vector<string> > trainingSequences, int markovOrder = 1, bool keepTrainingSequences = false);
+
+  /**
+   * @brief Add training sentences to a trained model
+   * 
+   * Merges the counts of the sentences into the rows they touch and
+   * rebuilds the index. Rows the sentences do not touch are copied over
+   * (with new state IDs if words or contexts were added), so no previous
+   * sentence is needed. The model gets a new index ID, and
+   * must not be in use by other threads meanwhile.
+   * 
+   * @param sentences sentences to add
+   */
+  void update(const vector< vector<string> > &sentences);
+
+  /**
+   * @brief Add the sentences of an update text unless they were added before
+   * 
+   * Updates are recorded by a hash of their sentences, which is cached
+   * with the model, so repeating an update does not count it twice
+   * 
+   * @param sentences sentences of the update text
+   * @return true if the sentences were added
+   */
+  bool applyUpdate(const vector< vector<string> > &sentences);
+
+  /**
+   * @brief Hash the sentences of an update text
+   * 
+   * Names the cache of the updated model, so the cache of the
+   * model it was applied to is never overwritten
+   * 
+   * @param sentences sentences of the update text
+   * @return uint64_t hash recorded by applyUpdate()
+   */
+  static uint64_t getUpdateHash(const vector< vector<string> > &sentences);
 
   /**
    * @brief Generates a sentence
    * 
+   * Follows the context states, so higher orders condition on the
+   * last markovOrder words
+   * 
    * @return vector<string> array of words making up a sentence
    * @author Porter Glines 1/13/19
    */
@@ -48,12 +115,33 @@ public:
    * @brief Get the probability of a specific sentence being generated
    * 
    * multiplies the probabilities between each word to get the total
-   * probability of a sentence
+   * probability of a sentence. Follows the context states like
+   * getSentenceLogProbability(), but skips unseen transitions (the
+   * context then restarts at the word)
    * 
    * @param sentence generated sentence
    * @return double probability of the given sentence
    */
-  double getSentenceProbability(vector<string> sentence);
+  double getSentenceProbability(const vector<string> &sentence) const;
+
+  /**
+   * @brief Get the log probability of a sentence given by vocabulary IDs
+   * 
+   * Follows the context states from START without allocating or
+   * modifying the model, so it may be called from any thread
+   * 
+   * @param wordIds vocabulary IDs of the sentence's words
+   * @return double natural log probability (-inf if a transition is unseen)
+   */
+  double getSentenceLogProbability(const vector<int> &wordIds) const;
+
+  /**
+   * @brief Score many sentences in parallel on the TaskPool
+   * 
+   * @param sentences sentences as vocabulary IDs
+   * @return vector<double> log probability of each sentence (see getSentenceLogProbability())
+   */
+  vector<double> getSentenceLogProbabilities(const vector< vector<int> > &sentences) const;
 
   /**
    * @brief Print the transition probabilities for debugging
@@ -65,21 +153,241 @@ public:
    * @return int markov order
    * @author Porter Glines 5/5/19
    */
-  int getMarkovOrder() { return this->markovOrder; }
+  int getMarkovOrder() const { return this->markovOrder; }
 
   /**
    * @brief Get the training sequences
-   * @return training sequences
+   * @return training sequences (empty unless the model was trained to keep them)
    * @author Porter Glines 5/5/19
    */
-  vector< vector<string> > getTrainingSequences() { return this->trainingSequences; }
+  const vector< vector<string> > &getTrainingSequences() const { return this->trainingSequences; }
 
   /**
-   * @brief Get the probability matrix
-   * @return unordered_map< string, unordered_map<string, double> > transition probabilities
-   * @author Porter Glines 5/5/19
+   * @brief Get the number of training sentences counted
+   * @return uint32_t sentence count (the START row total)
+   */
+  uint32_t getSentenceCount() const { return this->rowTotals.empty() ? 0 : this->rowTotals[START_ID]; }
+
+  /**
+   * @brief Get the number of times a word occurs in the training sentences
+   * 
+   * The frequencies serve as the prior probabilities of words
+   * 
+   * @param wordId vocabulary ID
+   * @return uint32_t word frequency (0 for START and END)
+   */
+  uint32_t getWordFrequency(int wordId) const { return this->wordFrequencies[wordId]; }
+
+  /**
+   * @brief Check whether the model was trained or read from the cache
+   * @return true if the model has a vocabulary
+   */
+  bool isTrained() const { return !this->vocabulary.empty(); }
+
+  /**
+   * @brief Get the probability of a word following another
+   * 
+   * Reads the rows of START and single words, which count every word
+   * that follows them whatever the markov order
+   * 
+   * @param word current word (or START)
+   * @param nextWord next word (or END)
+   * @return double count of the transition over its row total (0 if unseen)
+   */
+  double getTransitionProbability(const string &word, const string &nextWord) const;
+
+  /**
+   * @brief Get the vocabulary indexed by vocabulary ID
+   *
+   * START and END are reserved as the first IDs, followed by the
+   * remaining words in sorted order (see getFirstWordId())
+   *
+   * @return const vector<string>& words by vocabulary ID
+   */
+  const vector<string> &getVocabulary() const { return this->vocabulary; }
+
+  /**
+   * @brief Get the vocabulary ID of a word
+   * @param word word to look up
+   * @return int vocabulary ID or -1 if the word is unknown
+   */
+  int getWordId(const string &word) const;
+
+  /**
+   * @brief Get the vocabulary IDs of words
+   * @param words words to look up
+   * @return vector<int> vocabulary IDs (-1 for unknown words)
+   */
+  vector<int> getWordIds(const vector<string> &words) const;
+
+  /**
+   * @brief Get the ID of the model's current index
+   *
+   * Unique per process each time the index is built, so data derived
+   * from the model (e.g. cached layers) can be keyed by it
+   *
+   * @return int index ID
+   */
+  int getIndexId() const { return this->indexId; }
+
+  /**
+   * @brief Get the first vocabulary ID that is not a START/END marker
+   * @return int first word ID
+   */
+  int getFirstWordId() const { return FIRST_WORD_ID; }
+
+  /**
+   * @brief Get the sorted vocabulary IDs of all words starting with a letter
+   * @param letter first character of the words
+   * @return const vector<int>& sorted vocabulary IDs
+   */
+  const vector<int> &getFirstLetterBucket(char letter) const { return this->firstLetterBuckets[(unsigned char)letter]; }
+
+  /**
+   * @brief Get the number of context states
+   *
+   * A state is the context of the last markovOrder words. State IDs
+   * START, END and every word's single-word context equal their
+   * vocabulary IDs, so a first order model's states are its words.
+   * Longer contexts follow, grouped by length and sorted by last word.
+   *
+   * @return int state count
+   */
+  int getStateCount() const { return (int)this->stateWords.size(); }
+
+  /**
+   * @brief Get the most recent word of a state
+   * @param stateId state ID
+   * @return int vocabulary ID
+   */
+  int getStateWord(int stateId) const { return this->stateWords[stateId]; }
+
+  /**
+   * @brief Get the first state that can occur at a sentence position
+   *
+   * The states of a position (contexts of min(position + 1, markovOrder)
+   * words) are contiguous
+   *
+   * @param position word position in the sentence
+   * @return int first state ID
+   */
+  int getPositionStatesBegin(int position) const { return this->contextLengthBegins[getContextLength(position) - 1]; }
+
+  /**
+   * @brief Get the state past the last state of a sentence position
+   * @param position word position in the sentence
+   * @return int state ID past the last state
+   */
+  int getPositionStatesEnd(int position) const { return this->contextLengthBegins[getContextLength(position)]; }
+
+  /**
+   * @brief Get the first state of a position ending in a word
+   *
+   * States ending in the same word are contiguous within a position
+   *
+   * @param wordId vocabulary ID
+   * @param position word position in the sentence
+   * @return int first state ID
+   */
+  int getWordStatesBegin(int wordId, int position) const { return this->wordStateOffsets[getContextLength(position) - 1][wordId]; }
+
+  /**
+   * @brief Get the state past the last state of a position ending in a word
+   * @param wordId vocabulary ID
+   * @param position word position in the sentence
+   * @return int state ID past the last state
+   */
+  int getWordStatesEnd(int wordId, int position) const { return this->wordStateOffsets[getContextLength(position) - 1][wordId + 1]; }
+
+  /**
+   * @brief Get the index of the first transition of a state
+   *
+   * Transitions of a state are stored contiguously from
+   * getTransitionBegin(stateId) to getTransitionEnd(stateId) in
+   * getTransitionTargets() and getTransitionCounts(),
+   * sorted by target state ID
+   *
+   * @param stateId state ID (the vocabulary ID for first order models)
+   * @return int index of the first transition
+   */
+  int getTransitionBegin(int stateId) const { return this->transitionOffsets[stateId]; }
+
+  /**
+   * @brief Get the index past the last transition of a state
+   * @param stateId state ID
+   * @return int index past the last transition
+   */
+  int getTransitionEnd(int stateId) const { return this->transitionOffsets[stateId + 1]; }
+
+  /**
+   * @brief Get the target state IDs of all transitions
+   * @return const vector<int>& target state IDs
+   */
+  const vector<int> &getTransitionTargets() const { return this->transitionTargets; }
+
+  /**
+   * @brief Get the counts of all transitions
+   *
+   * Probabilities are not stored; a transition's probability is its
+   * count over the row total (see getRowTotal())
+   *
+   * @return const vector<uint32_t>& transition counts
+   */
+  const vector<uint32_t> &getTransitionCounts() const { return this->transitionCounts; }
+
+  /**
+   * @brief Get the sum of the counts of a state's transitions
+   * @param stateId state ID
+   * @return uint32_t row total (0 for END)
+   */
+  uint32_t getRowTotal(int stateId) const { return this->rowTotals[stateId]; }
+
+  /**
+   * @brief Get the probability of a transition
+   * @param stateId state ID of the row
+   * @param e index of the transition (within the row)
+   * @return double count over the row total
+   */
+  double getTransitionProbability(int stateId, int e) const { return (double)this->transitionCounts[e] / this->rowTotals[stateId]; }
+
+  /**
+   * @brief Get the packed attributes of a word
+   * @param wordId vocabulary ID
+   * @return const WordAttributes& attributes of the word
+   */
+  const WordAttributes &getWordAttributes(int wordId) const { return this->wordAttributes[wordId]; }
+
+  /**
+   * @brief Get the bitset (over vocabulary IDs) of every actual word (no START/END)
+   * @return const Bitset& word bits
    */
-  unordered_map< string, unordered_map<string, double> > getProbabilityMatrix() { return this->transitionProbs; }
+  const Bitset &getWordBits() const { return this->wordBits; }
+
+  /**
+   * @brief Get the bitset (over vocabulary IDs) of words starting with a letter
+   * @param letter first character of the words
+   * @return const Bitset& first letter bits
+   */
+  const Bitset &getFirstLetterBits(char letter) const;
+
+  /**
+   * @brief Get the bitset (over vocabulary IDs) of words with at least a given length
+   * @param length minimum character count (clamped to MAX_TRACKED_LENGTH)
+   * @return const Bitset& minimum length bits
+   */
+  const Bitset &getMinLengthBits(int length) const;
+
+  /**
+   * @brief Get the bitset (over vocabulary IDs) of stop words
+   * @return const Bitset& stop word bits
+   */
+  const Bitset &getStopWordBits() const { return this->stopWordBits; }
+
+  /**
+   * @brief Get the bitset (over vocabulary IDs) of words that can end a sentence
+   * @return const Bitset& ends sentence bits
+   */
+  const Bitset &getEndsSentenceBits() const { return this->endsSentenceBits; }
 
 protected:
   /// Marker representing the start of a sentence
@@ -92,77 +400,167 @@ protected:
 
   int sentenceLength;
 
+  /// Vocabulary ID of START
+  static const int START_ID = 0;
+  /// Vocabulary ID of END
+  static const int END_ID = 1;
+  /// First vocabulary ID of an actual word
+  static const int FIRST_WORD_ID = 2;
+  /// Longest word length with its own minimum length bitset
+  static const int MAX_TRACKED_LENGTH = 16;
+  /// Highest supported markov order
+  static const int MAX_MARKOV_ORDER = 4;
+
   /// Random generator
-  mt19937 randGenerator;
-  /// Random distribution used by the generator
-  uniform_real_distribution<double> randDistribution;
+  RandomGenerator randGenerator;
 
 private:
-  /// Transition probability matrices mapping words -> (word, prob), (word, prob)...
-  unordered_map< string, unordered_map<string, double> > transitionProbs;
 
+  /// Training sentences (only retained if keepTrainingSequences)
   vector< vector<string> > trainingSequences;
+  /// Whether train() and update() retain their sentences
+  bool keepTrainingSequences;
+  /// Hashes of the update texts added by applyUpdate()
+  vector<uint64_t> appliedUpdates;
+  /// Threads counting training sentences (see Options::getIngestThreads())
+  int threadCount;
+
+  /// Unique ID of the built index
+  int indexId;
+
+  /// Words by vocabulary ID
+  vector<string> vocabulary;
+  /// Vocabulary IDs by word (not serialized)
+  unordered_map<string, int> vocabularyIds;
+  /// Sorted vocabulary IDs of words, bucketed by their first character
+  vector< vector<int> > firstLetterBuckets;
+
+  /// Occurrences of each word in the training sentences by vocabulary ID
+  vector<uint32_t> wordFrequencies;
+
+  /// Most recent word of each state (identity for first order models)
+  vector<int> stateWords;
+  /// First state ID of each context length (index length - 1), then the state count
+  vector<int> contextLengthBegins;
+  /// Words of each context longer than one word, markovOrder IDs per state (oldest first, 0 for padding)
+  vector<uint32_t> contextWords;
+  /// Per context length, offsets by vocabulary ID of the states ending in each word (not serialized)
+  vector< vector<int> > wordStateOffsets;
+
+  /// Offsets of each state's transitions (compressed sparse rows)
+  vector<int> transitionOffsets;
+  /// Target state ID of each transition
+  vector<int> transitionTargets;
+  /// Count of each transition
+  vector<uint32_t> transitionCounts;
+  /// Sum of the counts of each state's transitions (not serialized)
+  vector<uint32_t> rowTotals;
+
+  /// Unary attributes by vocabulary ID
+  vector<WordAttributes> wordAttributes;
+  /// Bitset of actual words (no START/END)
+  Bitset wordBits;
+  /// Bitsets of words by first character (empty for unused characters)
+  vector<Bitset> firstLetterBits;
+  /// Bitsets of words with at least i characters
+  vector<Bitset> minLengthBits;
+  /// Bitset of stop words
+  Bitset stopWordBits;
+  /// Bitset of words that are followed by END
+  Bitset endsSentenceBits;
+  /// Bitset with no words set
+  Bitset emptyBits;
 
   friend class boost::serialization::access;
 
   template<class Archive>
-  void serialize(Archive &ar, const unsigned int /*version*/);
-  // template<class Archive>
-  // void serialize(Archive &ar, const unsigned int /*version*/) {
-  //   ar & this->markovOrder;
-  //   ar & this->trainingSequences;
-  //   ar & this->transitionProbs;
-  // }
+  void save(Archive &ar, const unsigned int version) const;
+  template<class Archive>
+  void load(Archive &ar, const unsigned int version);
+  BOOST_SERIALIZATION_SPLIT_MEMBER()
 
   /**
-   * @brief Get the next word in a sentence given the previous word
-   * 
-   * Adheres to the markov property
-   * 
-   * @param prevWord previous word
-   * @return string next word generated
+   * @brief Build the word state offsets, row totals, first-letter
+   * buckets and word attributes from the vocabulary and transition counts
+   *
+   * Called once whenever the model is trained, updated or read from the cache
+   *
    */
-  string getNextWord(const string& prevWord);
+  void buildIndex();
 
   /**
-   * @brief Calculate the probability of a sentence
-   * 
-   * @param sentence sentence consisting of words
-   * @return double probability of sentence
-   * @author Porter Glines 1/26/19
+   * @brief Add the words of sentences to the vocabulary
+   *
+   * Words stay sorted, so adding words shifts the IDs of later words
+   *
+   * @param sentences sentences whose words are added
+   * @return vector<int> new vocabulary ID of each previous vocabulary ID
    */
-  double calculateProbability(vector<string> sentence);
+  vector<int> addVocabulary(const vector< vector<string> > &sentences);
 
+  /**
+   * @brief Add the words and transitions of sentences to the counts
+   * @param sentences sentences to count (already in the vocabulary)
+   * @param newIds new vocabulary ID of each previous ID (see addVocabulary())
+   */
+  void addCounts(const vector< vector<string> > &sentences, const vector<int> &newIds);
 
   /**
-   * @brief Calculate the frequencies of words
+   * @brief Merge the context states and transitions of sentences into the rows
+   *
+   * New contexts are merged into the sorted previous ones, and the new
+   * transitions into the previous rows, remapped to the new state IDs
+   *
+   * @tparam Order markov order (1 to MAX_MARKOV_ORDER)
+   * @param sentences sentences to count
+   * @param newIds new vocabulary ID of each previous ID (see addVocabulary())
+   */
+  template <int Order>
+  void addContextCounts(const vector< vector<string> > &sentences, const vector<int> &newIds);
+
+  /**
+   * @brief Get the number of words in the context of a sentence position
+   * @param position word position in the sentence
+   * @return int context length
+   */
+  int getContextLength(int position) const { return min(position + 1, max(1, this->markovOrder)); }
+
+  /**
+   * @brief Sample the next state of a sentence given the current state
    * 
-   * The frequencies can be used as the prior probabilities
+   * Adheres to the markov property
    * 
-   * @param sentences training sentences
-   * @return unordered_map<string, int> Frequences map (word, frequency)
-   * @author Porter Glines 1/26/19
+   * @param stateId current context state (START_ID at the start of a sentence)
+   * @return int next state (END_ID at the end of the sentence), or -1 if the state has no successors
    */
-  unordered_map<string, int> getWordFrequencies(vector< vector<string> > sentences);
+  int getNextState(int stateId);
 
   /**
-   * @brief Normalize a map to have values from 0 to 1
-   *
-   * @param map to normalize
-   * @author Porter Glines 1/16/19
+   * @brief Find the transition from a state to the state ending in a word
+   * 
+   * @param stateId current context state
+   * @param wordId vocabulary ID of the next word
+   * @param position position of the next word in the sentence
+   * @return int transition index (see getTransitionProbability()), or -1 if unseen
    */
-  void normalize(unordered_map<string, double> &map);
+  int findTransition(int stateId, int wordId, int position) const;
 
   /**
-   * @brief Increment the probability in the probability matrix for a word given its next word
+   * @brief Calculate the probability of a sentence
    * 
-   * @param transitionProbs transition probability matrix mapping words -> (word, prob), (word, prob)...
-   * @param word current word
-   * @param nextWord next word
+   * @param sentence sentence consisting of words
+   * @return double probability of sentence
+   * @author Porter Glines 1/26/19
    */
-  void increment(unordered_map< string, unordered_map<string, double> > &transitionProbs, string word, const string& nextWord);
+  double calculateProbability(vector<string> sentence);
+
 };
 
 #include "markov.inl"
 
+/// Version 4 stores the transition counts by context state, the unigram
+/// table and the hashes of the applied updates. Older caches are named
+/// differently (see CorpusReader::getCorpusName()), so they are never read
+BOOST_CLASS_VERSION(MarkovModel, 4)
+
 #endif
\ No newline at end of file
@@ -1,8 +1,39 @@
 #include "markov.h"
 
 template<class Archive>
-void MarkovModel::serialize(Archive &ar, const unsigned int /*version*/) {
+void MarkovModel::save(Archive &ar, const unsigned int /*version*/) const {
   ar & this->markovOrder;
+  ar & this->keepTrainingSequences;
   ar & this->trainingSequences;
-  ar & this->transitionProbs;
-}
\ No newline at end of file
+  ar & this->vocabulary;
+  ar & this->wordFrequencies;
+  ar & this->stateWords;
+  ar & this->contextLengthBegins;
+  ar & this->contextWords;
+  ar & this->transitionOffsets;
+  ar & this->transitionTargets;
+  ar & this->transitionCounts;
+  ar & this->appliedUpdates;
+}
+
+template<class Archive>
+void MarkovModel::load(Archive &ar, const unsigned int /*version*/) {
+  ar & this->markovOrder;
+  ar & this->keepTrainingSequences;
+  ar & this->trainingSequences;
+  ar & this->vocabulary;
+  ar & this->wordFrequencies;
+  ar & this->stateWords;
+  ar & this->contextLengthBegins;
+  ar & this->contextWords;
+  ar & this->transitionOffsets;
+  ar & this->transitionTargets;
+  ar & this->transitionCounts;
+  ar & this->appliedUpdates;
+
+  vocabularyIds.clear();
+  vocabularyIds.reserve(vocabulary.size());
+  for (int id = 0; id < (int)vocabulary.size(); id++) {
+    vocabularyIds.emplace(vocabulary[id], id);
+  }
+}
@@ -7,7 +7,7 @@ class MnemonicMarkovModel : public ConstrainedMarkovModel {
 public:
   MnemonicMarkovModel();
 
-  MnemonicMarkovModel(MarkovModel markovModel, string constraint, Options options);
+  MnemonicMarkovModel(const MarkovModel &markovModel, string constraint, Options options);
 
   ~MnemonicMarkovModel() {};
 
@@ -25,9 +25,10 @@ public:
    * "The weather door"
    * 
    * @param constraintSequence sequence of constraints
+   * @param layerIndex layer to apply the constraint to
    * @author Porter Glines 1/21/19
    */
-  void applyConstraints(vector<string> constraintSequence);
+  void applyConstraint(const vector<string> &constraintSequence, int layerIndex);
 };
 
 #endif
\ No newline at end of file
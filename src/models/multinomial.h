@@ -0,0 +1,74 @@
+#ifndef MULTINOMIAL_H
+#define MULTINOMIAL_H
+
+#include <random>
+#include <algorithm>
+
+/**
+ * @brief Split count draws among weighted outcomes (a multinomial draw)
+ *
+ * Draws each outcome's share as a binomial of the draws left over the
+ * weight left, so the cost is linear in the outcomes visited and does
+ * not depend on the count. Stops early once every draw is assigned.
+ * A handful of draws are made one at a time instead.
+ *
+ * @param count number of draws
+ * @param weights non-negative weight of each outcome (need not sum to 1)
+ * @param size number of outcomes
+ * @param generator random generator
+ * @param counts output, draws per outcome (size entries)
+ */
+template <class Generator>
+void splitMultinomial(int count, const double *weights, int size, Generator &generator, int *counts) {
+  double remainingWeight = 0.0;
+  for (int k = 0; k < size; k++) {
+    remainingWeight += weights[k];
+    counts[k] = 0;
+  }
+
+  // A few draws are cheaper one at a time than a binomial per outcome
+  if (count <= 4) {
+    std::uniform_real_distribution<double> uniform(0.0, remainingWeight);
+    for (int i = 0; i < count; i++) {
+      double randomValue = uniform(generator);
+      double sum = 0.0;
+      int k = 0;
+      int lastPositive = -1;
+      for (; k < size; k++) {
+        if (weights[k] > 0.0) {
+          lastPositive = k;
+          sum += weights[k];
+          if (sum > randomValue) {
+            break;
+          }
+        }
+      }
+      if (lastPositive >= 0) {
+        counts[(k < size) ? k : lastPositive]++;  // rounding may leave the sum just under randomValue
+      }
+    }
+    return;
+  }
+
+  int lastOutcome = size - 1;
+  while (lastOutcome >= 0 && weights[lastOutcome] <= 0.0) {
+    lastOutcome--;
+  }
+
+  for (int k = 0; k <= lastOutcome && count > 0; k++) {
+    if (weights[k] <= 0.0) {
+      continue;
+    }
+    // The last outcome takes whatever rounding left over
+    if (k == lastOutcome || weights[k] >= remainingWeight) {
+      counts[k] = count;
+      return;
+    }
+    std::binomial_distribution<int> binomial(count, weights[k] / remainingWeight);
+    counts[k] = binomial(generator);
+    count -= counts[k];
+    remainingWeight -= weights[k];
+  }
+}
+
+#endif
@@ -0,0 +1,81 @@
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#include "normalizekernel.h"
+
+
+/**
+ * Multiplies the edges [begin, end) by the gathered next sums in place
+ * and returns their total
+ */
+static double scaleByNextSums(const int *targets, double *probs, const double *nextSums, int begin, int end) {
+  int e = begin;
+  double sum = 0.0;
+
+#ifdef __AVX2__
+  __m256d acc = _mm256_setzero_pd();
+  for (; e + 4 <= end; e += 4) {
+    __m128i indices = _mm_loadu_si128((const __m128i *)(targets + e));
+    __m256d next = _mm256_i32gather_pd(nextSums, indices, 8);
+    __m256d prod = _mm256_mul_pd(_mm256_loadu_pd(probs + e), next);
+    _mm256_storeu_pd(probs + e, prod);
+    acc = _mm256_add_pd(acc, prod);
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, acc);
+  sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+
+  for (; e < end; e++) {
+    probs[e] *= nextSums[targets[e]];
+    sum += probs[e];
+  }
+  return sum;
+}
+
+
+void NormalizeKernel::normalizeRows(const int *offsets, const int *targets, double *probs,
+                                    const double *nextSums, double *sums, int rowBegin, int rowEnd) {
+  for (int k = rowBegin; k < rowEnd; k++) {
+    int begin = offsets[k];
+    int end = offsets[k+1];
+
+    double sumA = scaleByNextSums(targets, probs, nextSums, begin, end);
+    sums[k] = sumA;
+
+    if (sumA == 0.0) {
+      continue;
+    }
+    double scale = 1.0 / sumA;
+    for (int e = begin; e < end; e++) {
+      probs[e] *= scale;
+    }
+  }
+}
+
+
+double NormalizeKernel::dotRange(const int *targets, const uint32_t *counts, const double *x, int begin, int end) {
+  int e = begin;
+  double sum = 0.0;
+
+#ifdef __AVX2__
+  __m256d acc = _mm256_setzero_pd();
+  for (; e + 4 <= end; e += 4) {
+    __m128i indices = _mm_loadu_si128((const __m128i *)(targets + e));
+    __m256d gathered = _mm256_i32gather_pd(x, indices, 8);
+    // Counts stay far below 2^31, so the signed conversion is exact
+    __m256d weights = _mm256_cvtepi32_pd(_mm_loadu_si128((const __m128i *)(counts + e)));
+    acc = _mm256_add_pd(acc, _mm256_mul_pd(weights, gathered));
+  }
+  double lanes[4];
+  _mm256_storeu_pd(lanes, acc);
+  sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+#endif
+
+  for (; e < end; e++) {
+    sum += (double)counts[e] * x[targets[e]];
+  }
+  return sum;
+}
+
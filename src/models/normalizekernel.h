@@ -0,0 +1,55 @@
+#ifndef NORMALIZE_KERNEL_H
+#define NORMALIZE_KERNEL_H
+
+/**
+ * @brief Sparse kernels used to normalize the layers of a constrained model
+ *
+ * Layers are stored as compressed sparse rows over dense layer-local
+ * indices, so each normalization step of Pachet's method is a sparse
+ * matrix-vector product followed by a row scaling. Kernels work on a
+ * block of rows so callers can split a layer across threads.
+ *
+ * Compiled with AVX2 (see MARKOV_NATIVE_ARCH) the products gather the
+ * next layer's sums four edges at a time.
+ */
+#include <stdint.h>
+
+namespace NormalizeKernel {
+
+  /**
+   * @brief Propagate backward sums through rows [rowBegin, rowEnd)
+   * and normalize their edge probabilities
+   *
+   * For every row k:
+   *   sums[k] = sum of probs[e] * nextSums[targets[e]]
+   *   probs[e] = probs[e] * nextSums[targets[e]] / sums[k]
+   *
+   * @param offsets edges of row k are [offsets[k], offsets[k+1])
+   * @param targets index into nextSums of each edge
+   * @param probs probability of each edge (normalized in place)
+   * @param nextSums backward sums of the next layer
+   * @param sums backward sums of this layer (output)
+   * @param rowBegin first row
+   * @param rowEnd row past the last row
+   */
+  void normalizeRows(const int *offsets, const int *targets, double *probs,
+                     const double *nextSums, double *sums, int rowBegin, int rowEnd);
+
+  /**
+   * @brief Sparse dot product of the edges [begin, end) with a dense vector
+   *
+   * Used for implicit (wildcard) layers, whose rows are read straight
+   * from the base model's counts and are never scaled in place
+   * (callers divide by the row total)
+   *
+   * @param targets index into x of each edge
+   * @param counts transition count of each edge
+   * @param x dense vector (e.g. backward sums by vocabulary ID)
+   * @param begin first edge
+   * @param end edge past the last edge
+   * @return double sum of counts[e] * x[targets[e]]
+   */
+  double dotRange(const int *targets, const uint32_t *counts, const double *x, int begin, int end);
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include <string>
 #include <string.h>
+#include <stdlib.h>
 #include <algorithm>
 
 #include "options.h"
@@ -14,10 +15,26 @@ Options::Options() {
   this->markovOrder = 1;
   this->sentenceCount = 1;
   this->useCache = false;
-  this->trainingFilePath = "";
+  this->decodeBest = false;
+  this->distinctSentences = false;
+  this->useSeed = false;
+  this->seed = 0;
+  this->trainingFilePaths = vector<string>();
   this->trainingSentenceLimit = 0; // no limit
+  this->trainingTokenLimit = 0;
+  this->trainingByteLimit = 0;
+  this->updateFilePath = "";
+  this->keepTrainingSentences = false;
+  this->layerCacheSize = 0;  // MB (off)
+  this->sessionTimeout = 300;  // seconds
+  this->compileThreads = 0;
+  this->jobCount = 0;
+  this->ingestThreads = 0;
+  this->scoreFilePath = "";
+  this->batchFilePath = "";
   this->port = 7799;  // unassigned port
   this->shouldRunAsServer = false;
+  this->shouldRunInteractive = false;
 }
 
 void Options::parseArguments(int argc, char *argv[]) {
@@ -66,10 +83,89 @@ void Options::parseArguments(int argc, char *argv[]) {
         this->trainingSentenceLimit = atoi(argv[++i]);
       }
 
+    // Training word budget
+    } else if (strcasecmp(argv[i], "--tokenlimit") == 0) {
+      if (i+1 < argc) {
+        this->trainingTokenLimit = atol(argv[++i]);
+      }
+
+    // Training text budget
+    } else if (strcasecmp(argv[i], "--bytelimit") == 0) {
+      if (i+1 < argc) {
+        this->trainingByteLimit = atol(argv[++i]);
+      }
+
     // Use cached files
     } else if (strcasecmp(argv[i], "--cache") == 0) {
       this->useCache = true;
 
+    // Generate the most probable sentences
+    } else if (strcasecmp(argv[i], "--best") == 0) {
+      this->decodeBest = true;
+
+    // Generate sentences without duplicates
+    } else if (strcasecmp(argv[i], "--distinct") == 0) {
+      this->distinctSentences = true;
+
+    // Random seed
+    } else if (strcasecmp(argv[i], "--seed") == 0) {
+      if (i+1 < argc) {
+        this->useSeed = true;
+        this->seed = strtoull(argv[++i], nullptr, 10);
+      }
+
+    // Text added to the trained model
+    } else if (strcasecmp(argv[i], "--update") == 0) {
+      if (i+1 < argc) {
+        this->updateFilePath = argv[++i];
+      }
+
+    // Retain the training sentences in the model
+    } else if (strcasecmp(argv[i], "--keepsentences") == 0) {
+      this->keepTrainingSentences = true;
+
+    // Threads reading the training text
+    } else if (strcasecmp(argv[i], "--ingestthreads") == 0) {
+      if (i+1 < argc) {
+        this->ingestThreads = atoi(argv[++i]);
+      }
+
+    // Layer cache size
+    } else if (strcasecmp(argv[i], "--layercache") == 0) {
+      if (i+1 < argc) {
+        this->layerCacheSize = atoi(argv[++i]);
+      }
+
+    // Idle session timeout
+    } else if (strcasecmp(argv[i], "--sessiontimeout") == 0) {
+      if (i+1 < argc) {
+        this->sessionTimeout = atoi(argv[++i]);
+      }
+
+    // Threads compiling one constraint
+    } else if (strcasecmp(argv[i], "--compilethreads") == 0) {
+      if (i+1 < argc) {
+        this->compileThreads = atoi(argv[++i]);
+      }
+
+    // Constraints compiled concurrently
+    } else if (strcasecmp(argv[i], "--jobs") == 0 || strcasecmp(argv[i], "-j") == 0) {
+      if (i+1 < argc) {
+        this->jobCount = atoi(argv[++i]);
+      }
+
+    // Text file to score
+    } else if (strcasecmp(argv[i], "--score") == 0) {
+      if (i+1 < argc) {
+        this->scoreFilePath = argv[++i];
+      }
+
+    // File of constraints to run
+    } else if (strcasecmp(argv[i], "--batch") == 0) {
+      if (i+1 < argc) {
+        this->batchFilePath = argv[++i];
+      }
+
     // Port number
     } else if (strcasecmp(argv[i], "--port") == 0 || strcasecmp(argv[i], "-p") == 0) {
       if (i+1 < argc) {
@@ -80,9 +176,13 @@ void Options::parseArguments(int argc, char *argv[]) {
     } else if (strcasecmp(argv[i], "--server") == 0 || strcasecmp(argv[i], "-s") == 0) {
       this->shouldRunAsServer = true;
 
-    // Training file path
+    // Interactive flag
+    } else if (strcasecmp(argv[i], "--interactive") == 0 || strcasecmp(argv[i], "-i") == 0) {
+      this->shouldRunInteractive = true;
+
+    // Training file or directory paths
     } else {
-      this->trainingFilePath = argv[i];
+      this->trainingFilePaths.push_back(argv[i]);
     }
   }
 }
@@ -116,17 +216,85 @@ bool Options::getUseCache() {
 }
 
 string Options::getTrainingFilePath() {
-  return this->trainingFilePath;
+  return this->trainingFilePaths.empty() ? "" : this->trainingFilePaths[0];
+}
+
+vector<string> Options::getTrainingFilePaths() {
+  return this->trainingFilePaths;
 }
 
 int Options::getTrainingSentenceLimit() {
   return this->trainingSentenceLimit;
 }
 
+long Options::getTrainingTokenLimit() {
+  return this->trainingTokenLimit;
+}
+
+long Options::getTrainingByteLimit() {
+  return this->trainingByteLimit;
+}
+
+bool Options::getDecodeBest() {
+  return this->decodeBest;
+}
+
+bool Options::getDistinctSentences() {
+  return this->distinctSentences;
+}
+
+bool Options::getUseSeed() {
+  return this->useSeed;
+}
+
+uint64_t Options::getSeed() {
+  return this->seed;
+}
+
+string Options::getUpdateFilePath() {
+  return this->updateFilePath;
+}
+
+bool Options::getKeepTrainingSentences() {
+  return this->keepTrainingSentences;
+}
+
+int Options::getIngestThreads() {
+  return this->ingestThreads;
+}
+
+int Options::getLayerCacheSize() {
+  return this->layerCacheSize;
+}
+
+int Options::getSessionTimeout() {
+  return this->sessionTimeout;
+}
+
+int Options::getCompileThreads() {
+  return this->compileThreads;
+}
+
+int Options::getJobCount() {
+  return this->jobCount;
+}
+
+string Options::getScoreFilePath() {
+  return this->scoreFilePath;
+}
+
+string Options::getBatchFilePath() {
+  return this->batchFilePath;
+}
+
 int Options::getPort() {
   return this->port;
 }
 
 bool Options::getShouldRunAsServer() {
   return this->shouldRunAsServer;
+}
+
+bool Options::getShouldRunInteractive() {
+  return this->shouldRunInteractive;
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <string>
 #include <vector>
+#include <stdint.h>
 
 using namespace std;
 
@@ -16,7 +17,14 @@ using namespace std;
  * --markovorder | -m
  * -n
  * --cache
- * trainingFilePath
+ * --best
+ * --distinct
+ * --seed
+ * --layercache
+ * --sessiontimeout
+ * --compilethreads
+ * --score
+ * trainingFilePaths (files or directories)
  * 
  * @author Porter Glines 5/19/19
  */
@@ -92,11 +100,18 @@ public:
   /**
    * @brief Get the Training File Path object
    * 
-   * @return string file path
+   * @return string first training file path ("" if none)
    * @author Porter Glines 5/19/19 
    */
   string getTrainingFilePath();
 
+  /**
+   * @brief Get the Training File Paths object
+   * 
+   * @return vector<string> training files or directories, in reading order
+   */
+  vector<string> getTrainingFilePaths();
+
   /**
    * @brief Get the Training Sentence Limit object
    * 
@@ -105,6 +120,114 @@ public:
    */
   int getTrainingSentenceLimit();
 
+  /**
+   * @brief Get the Training Token Limit object
+   * 
+   * @return long words of training text read before reading stops (0 for no limit)
+   */
+  long getTrainingTokenLimit();
+
+  /**
+   * @brief Get the Training Byte Limit object
+   * 
+   * @return long bytes of training text read before reading stops (0 for no limit)
+   */
+  long getTrainingByteLimit();
+
+  /**
+   * @brief Get the Decode Best object
+   * 
+   * @return true if the most probable sentences are generated instead of samples
+   */
+  bool getDecodeBest();
+
+  /**
+   * @brief Get the Distinct Sentences object
+   * 
+   * @return true if sentences are sampled without replacement (no duplicates)
+   */
+  bool getDistinctSentences();
+
+  /**
+   * @brief Get the Use Seed object
+   * 
+   * @return true if a seed was given (see getSeed())
+   */
+  bool getUseSeed();
+
+  /**
+   * @brief Get the Seed object
+   * 
+   * @return uint64_t seed of the random generators (for reproducible runs)
+   */
+  uint64_t getSeed();
+
+  /**
+   * @brief Get the Update File Path object
+   * 
+   * @return string text added to the trained model once; with --cache the updated model is cached apart from it ("" if none)
+   */
+  string getUpdateFilePath();
+
+  /**
+   * @brief Get the Keep Training Sentences object
+   * 
+   * @return true if the model retains its training sentences (only counts are needed otherwise); models cached with and without them are kept apart
+   */
+  bool getKeepTrainingSentences();
+
+  /**
+   * @brief Get the Ingest Threads object
+   * 
+   * @return int threads tokenizing and counting the training text (0 for every core)
+   */
+  int getIngestThreads();
+
+  /**
+   * @brief Get the Layer Cache Size object
+   * 
+   * @return int memory budget of the constraint layer cache in MB (0, the default, disables it)
+   */
+  int getLayerCacheSize();
+
+  /**
+   * @brief Get the Session Timeout object
+   * 
+   * @return int seconds an idle server session is kept
+   */
+  int getSessionTimeout();
+
+  /**
+   * @brief Get the Compile Threads object
+   * 
+   * @return int threads of the shared TaskPool, 0 if not given (then
+   * compiling is serial and bulk scoring uses every core)
+   */
+  int getCompileThreads();
+
+  /**
+   * @brief Get the Job Count object
+   * 
+   * @return int constraints compiled concurrently by the command line tool,
+   * 0 if not given (then every core is used, or one job in debug mode)
+   */
+  int getJobCount();
+
+  /**
+   * @brief Get the Score File Path object
+   * 
+   * @return string text file to score against the model ("" if none)
+   */
+  string getScoreFilePath();
+
+  /**
+   * @brief Get the Batch File Path object
+   * 
+   * @return string file of constraints to run, one per line ("-" for
+   * standard input, "" if none)
+   */
+  string getBatchFilePath();
+
   /**
    * @brief Get the port object
    * 
@@ -121,6 +244,13 @@ public:
    */
   bool getShouldRunAsServer();
 
+  /**
+   * @brief Get the shouldRunInteractive object
+   * 
+   * @return true if program should answer constraints typed at a prompt
+   */
+  bool getShouldRunInteractive();
+
 
 private:
   bool debug;
@@ -130,10 +260,26 @@ private:
   int markovOrder;
   int sentenceCount;
   bool useCache;
-  string trainingFilePath;
+  bool decodeBest;
+  bool distinctSentences;
+  bool useSeed;
+  uint64_t seed;
+  vector<string> trainingFilePaths;
   int trainingSentenceLimit;
+  long trainingTokenLimit;
+  long trainingByteLimit;
+  string updateFilePath;
+  bool keepTrainingSentences;
+  int ingestThreads;
+  int layerCacheSize;
+  int sessionTimeout;
+  int compileThreads;
+  int jobCount;
+  string scoreFilePath;
+  string batchFilePath;
   int port;
   bool shouldRunAsServer;
+  bool shouldRunInteractive;
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,43 @@
+#ifndef ORDEREDPIPELINE_H
+#define ORDEREDPIPELINE_H
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+
+/**
+ * @brief Runs work items on worker threads and hands back the results in input order
+ *
+ * Inputs are pulled from a source one at a time by the workers. Each result
+ * is passed to the sink on the calling thread as soon as every result before
+ * it is done, so output streams in input order while later items still run.
+ * At most maxInFlight items are pulled but not yet emitted, which bounds memory.
+ */
+template <typename Input, typename Output>
+class OrderedPipeline {
+public:
+  /**
+   * @param threadCount number of worker threads (at least 1)
+   * @param maxInFlight maximum number of items pulled but not yet emitted (at least threadCount)
+   */
+  OrderedPipeline(int threadCount, int maxInFlight);
+
+  /**
+   * @brief Process every input of a source
+   * @param source bool source(Input &) stores the next input and returns false at the end
+   *        (called by one worker at a time)
+   * @param work Output work(Input &) processes an input (called concurrently)
+   * @param sink void sink(Output &) consumes a result (called on this thread, in input order)
+   */
+  template <class Source, class Work, class Sink>
+  void run(Source source, Work work, Sink sink);
+
+private:
+  int threadCount;
+  int maxInFlight;
+};
+
+// Inline definitions to avoid template linking errors
+#include "orderedpipeline.inl"
+
+#endif
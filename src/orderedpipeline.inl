@@ -0,0 +1,81 @@
+// Inline definitions
+
+#include <vector>
+#include <algorithm>
+
+template <typename Input, typename Output>
+OrderedPipeline<Input, Output>::OrderedPipeline(int threadCount, int maxInFlight) {
+  this->threadCount = std::max(1, threadCount);
+  this->maxInFlight = std::max(this->threadCount, maxInFlight);
+}
+
+template <typename Input, typename Output>
+template <class Source, class Work, class Sink>
+void OrderedPipeline<Input, Output>::run(Source source, Work work, Sink sink) {
+  std::mutex mutex;
+  std::condition_variable cv;
+  std::map<long, Output> finished;
+  long pulledCount = 0;
+  long emittedCount = 0;
+  bool isSourceDone = false;
+
+  auto worker = [&]() {
+    while (true) {
+      Input input;
+      long index;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        cv.wait(lock, [&]() { return isSourceDone || pulledCount - emittedCount < maxInFlight; });
+        if (isSourceDone) {
+          return;
+        }
+        if (!source(input)) {
+          isSourceDone = true;
+          lock.unlock();
+          cv.notify_all();
+          return;
+        }
+        index = pulledCount++;
+      }
+
+      Output output = work(input);
+
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.emplace(index, std::move(output));
+      }
+      cv.notify_all();
+    }
+  };
+
+  std::vector<std::thread> workers;
+  for (int i = 0; i < threadCount; i++) {
+    workers.emplace_back(worker);
+  }
+
+  // Emit results in input order until the source is drained and everything pulled is emitted
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    cv.wait(lock, [&]() {
+      return finished.count(emittedCount) > 0 || (isSourceDone && emittedCount == pulledCount);
+    });
+    auto next = finished.find(emittedCount);
+    if (next == finished.end()) {
+      break;
+    }
+    Output output = std::move(next->second);
+    finished.erase(next);
+
+    lock.unlock();
+    sink(output);
+    lock.lock();
+
+    emittedCount++;
+    cv.notify_all();
+  }
+  lock.unlock();
+
+  for (auto &thread : workers) {
+    thread.join();
+  }
+}
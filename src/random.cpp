@@ -0,0 +1,49 @@
+#include "random.h"
+
+#include <random>
+#include <mutex>
+
+
+void Xoshiro256::jump() {
+  static const uint64_t JUMP[] = { 0x180EC6D33CFD0ABAULL, 0xD5A61266F0C9392CULL,
+                                   0xA9582618E03FC9AAULL, 0x39ABDC4529B1661CULL };
+
+  uint64_t jumped[4] = { 0, 0, 0, 0 };
+  for (int i = 0; i < 4; i++) {
+    for (int b = 0; b < 64; b++) {
+      if (JUMP[i] & (1ULL << b)) {
+        for (int j = 0; j < 4; j++) {
+          jumped[j] ^= state[j];
+        }
+      }
+      (*this)();
+    }
+  }
+  for (int j = 0; j < 4; j++) {
+    state[j] = jumped[j];
+  }
+}
+
+
+namespace Random {
+  static std::mutex seedMutex;
+  static bool isSeeded = false;
+  static RandomGenerator seedStream;
+
+  void setSeed(uint64_t seed) {
+    std::unique_lock<std::mutex> lock(seedMutex);
+    seedStream.seed(seed);
+    isSeeded = true;
+  }
+
+  RandomGenerator makeGenerator() {
+    std::unique_lock<std::mutex> lock(seedMutex);
+    if (!isSeeded) {
+      std::random_device rd;
+      return RandomGenerator(((uint64_t)rd() << 32) | rd());
+    }
+    RandomGenerator generator = seedStream;
+    seedStream.jump();
+    return generator;
+  }
+}
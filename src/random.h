@@ -0,0 +1,104 @@
+#ifndef MARKOV_RANDOM_H
+#define MARKOV_RANDOM_H
+
+#include <stdint.h>
+
+/**
+ * @brief xoshiro256++ pseudo random generator (Blackman & Vigna)
+ *
+ * Small and fast, with 256 bits of state. Satisfies the standard
+ * UniformRandomBitGenerator requirements, so it works with <random>
+ * distributions and std::shuffle. jump() advances the state by 2^128
+ * draws, which splits one seed into non-overlapping streams.
+ */
+class Xoshiro256 {
+public:
+  typedef uint64_t result_type;
+
+  explicit Xoshiro256(uint64_t seed = 0) { this->seed(seed); }
+
+  /**
+   * @brief Reset the state from a 64-bit seed (expanded with splitmix64)
+   * @param seed seed value
+   */
+  void seed(uint64_t seed) {
+    for (int i = 0; i < 4; i++) {
+      seed += 0x9E3779B97F4A7C15ULL;
+      uint64_t z = seed;
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+      state[i] = z ^ (z >> 31);
+    }
+  }
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return ~(result_type)0; }
+
+  result_type operator()() {
+    uint64_t result = rotl(state[0] + state[3], 23) + state[0];
+    uint64_t t = state[1] << 17;
+    state[2] ^= state[0];
+    state[3] ^= state[1];
+    state[1] ^= state[2];
+    state[0] ^= state[3];
+    state[2] ^= t;
+    state[3] = rotl(state[3], 45);
+    return result;
+  }
+
+  /**
+   * @brief Draw a uniform double in [0, 1) (53 random bits)
+   * @return double random value
+   */
+  double nextDouble() { return (double)((*this)() >> 11) * (1.0 / 9007199254740992.0); }  // 2^-53
+
+  /**
+   * @brief Draw uniform doubles in [0, 1) in bulk
+   * @param out output array
+   * @param count number of values
+   */
+  void fillDoubles(double *out, int count) {
+    for (int i = 0; i < count; i++) {
+      out[i] = nextDouble();
+    }
+  }
+
+  /**
+   * @brief Advance the state by 2^128 draws
+   */
+  void jump();
+
+private:
+  uint64_t state[4];
+
+  static uint64_t rotl(uint64_t x, int k) { return (x << k) | (x >> (64 - k)); }
+};
+
+
+/// Generator used by the models (swap the typedef to change generators)
+typedef Xoshiro256 RandomGenerator;
+
+
+/**
+ * @brief Process-wide source of generator seeds
+ */
+namespace Random {
+  /**
+   * @brief Make every later generator deterministic
+   *
+   * Generators made afterwards are successive jump-ahead streams of
+   * the seed, so they never overlap and a run made in the same order
+   * reproduces the same draws.
+   *
+   * @param seed seed value (see --seed)
+   */
+  void setSeed(uint64_t seed);
+
+  /**
+   * @brief Make a generator for a model or session
+   * @return RandomGenerator next stream of the seed, or randomly seeded if none was set
+   */
+  RandomGenerator makeGenerator();
+}
+
+#endif
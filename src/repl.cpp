@@ -0,0 +1,157 @@
+#include "repl.h"
+
+#include <vector>
+#include <chrono>
+#include <sstream>
+#include <stdio.h>
+#include <math.h>
+#include <stdlib.h>
+#include <strings.h>
+
+#include "utils.h"
+#include "models/mnemonicmarkov.h"
+
+
+Repl::Repl(const MarkovModel &model, Options options) {
+  this->model = &model;
+  this->sentenceCount = options.getSentenceCount();
+  this->mode = options.getDecodeBest() ? BEST : (options.getDistinctSentences() ? DISTINCT : SAMPLE);
+  this->useSeed = options.getUseSeed();
+  this->seed = options.getSeed();
+}
+
+
+void Repl::run(istream &in) {
+  printf("Type a constraint, or :help for commands.\n");
+  string line;
+  while (true) {
+    printf("> ");
+    fflush(stdout);
+    if (!getline(in, line)) {
+      printf("\n");
+      break;
+    }
+
+    size_t first = line.find_first_not_of(" \t\r");
+    if (first == string::npos) {
+      continue;
+    }
+    size_t last = line.find_last_not_of(" \t\r");
+    line = line.substr(first, last - first + 1);
+
+    if (line[0] == ':') {
+      if (!runCommand(line.substr(1))) {
+        break;
+      }
+    } else {
+      answer(line);
+    }
+  }
+}
+
+
+bool Repl::runCommand(const string &command) {
+  istringstream words(command);
+  string name, value;
+  words >> name >> value;
+
+  if (strcasecmp(name.c_str(), "quit") == 0 || strcasecmp(name.c_str(), "q") == 0) {
+    return false;
+
+  } else if (strcasecmp(name.c_str(), "n") == 0) {
+    if (atoi(value.c_str()) > 0) {
+      sentenceCount = atoi(value.c_str());
+    } else {
+      printf("ERROR::Sentence count must be positive\n");
+    }
+
+  } else if (strcasecmp(name.c_str(), "seed") == 0) {
+    // Every constraint after ":seed N" is sampled from the same seed, so answers repeat
+    if (value.empty() || strcasecmp(value.c_str(), "off") == 0) {
+      useSeed = false;
+    } else {
+      useSeed = true;
+      seed = strtoull(value.c_str(), nullptr, 10);
+    }
+
+  } else if (strcasecmp(name.c_str(), "mode") == 0) {
+    if (strcasecmp(value.c_str(), "sample") == 0) {
+      mode = SAMPLE;
+    } else if (strcasecmp(value.c_str(), "best") == 0) {
+      mode = BEST;
+    } else if (strcasecmp(value.c_str(), "distinct") == 0) {
+      mode = DISTINCT;
+    } else {
+      printf("ERROR::Unknown mode \"%s\" (sample, best or distinct)\n", value.c_str());
+    }
+
+  } else if (strcasecmp(name.c_str(), "show") == 0) {
+    printSettings();
+
+  } else if (strcasecmp(name.c_str(), "help") == 0 || strcasecmp(name.c_str(), "h") == 0) {
+    printHelp();
+
+  } else {
+    printf("ERROR::Unknown command \":%s\" (:help lists commands)\n", name.c_str());
+  }
+  return true;
+}
+
+
+void Repl::answer(const string &constraint) {
+  auto startTime = chrono::steady_clock::now();
+  auto constrainedModel = MnemonicMarkovModel(*model, Utils::cleanConstraint(constraint), Options());
+  if (useSeed) {
+    constrainedModel.setSeed(seed);
+  }
+  auto compiledTime = chrono::steady_clock::now();
+
+  vector<vector<string> > sentences;
+  if (mode == BEST) {
+    sentences = constrainedModel.generateBestSentences(sentenceCount);
+  } else if (mode == DISTINCT) {
+    sentences = constrainedModel.sampleDistinctSentences(sentenceCount);
+  } else {
+    sentences = constrainedModel.sampleSentences(sentenceCount);
+  }
+  auto sampledTime = chrono::steady_clock::now();
+
+  SolutionCount solutionCount = constrainedModel.getTotalSolutionCount();
+  auto countedTime = chrono::steady_clock::now();
+
+  if (isinf(solutionCount.log10Count)) {
+    printf("(no sentence satisfies the constraint)\n");
+  } else {
+    for (const auto &sentence : sentences) {
+      printf("%-10g: ", constrainedModel.getSentenceProbability(sentence));
+      for (const string &word : sentence) {
+        printf("%s ", word.c_str());
+      }
+      printf("\n");
+    }
+  }
+
+  auto seconds = [](chrono::steady_clock::time_point from, chrono::steady_clock::time_point to) {
+    return chrono::duration<double>(to - from).count();
+  };
+  printf("[solutions %s | compile %.4fs | generate %.4fs | count %.4fs]\n",
+         solutionCount.toString().c_str(), seconds(startTime, compiledTime),
+         seconds(compiledTime, sampledTime), seconds(sampledTime, countedTime));
+}
+
+
+void Repl::printSettings() const {
+  const char *modeNames[] = { "sample", "best", "distinct" };
+  printf("n %d | mode %s | seed %s\n", sentenceCount, modeNames[mode],
+         useSeed ? to_string(seed).c_str() : "off");
+}
+
+
+void Repl::printHelp() {
+  printf("constraint      generate sentences for a constraint (e.g. tws or \"t * s\")\n");
+  printf(":n N            number of sentences\n");
+  printf(":mode MODE      sample, best (most probable first) or distinct\n");
+  printf(":seed N | off   sample every constraint from seed N, or randomly\n");
+  printf(":show           print the current settings\n");
+  printf(":quit           exit\n");
+}
@@ -0,0 +1,63 @@
+#ifndef MARKOV_REPL_H
+#define MARKOV_REPL_H
+
+#include <string>
+#include <istream>
+#include <stdint.h>
+
+#include "options.h"
+#include "models/markov.h"
+
+using namespace std;
+
+
+/**
+ * @brief Interactive prompt answering constraints from a warm markov model
+ *
+ * The base model is trained (or loaded from the cache) once; every line
+ * after that is compiled and sampled against it in memory. Lines starting
+ * with ':' change the sentence count, seed and decoding mode, any other
+ * line is a constraint. Each answer is followed by its phase timings.
+ */
+class Repl {
+public:
+  /**
+   * @param model trained markov model (must outlive the prompt)
+   * @param options initial sentence count, seed and decoding mode
+   */
+  Repl(const MarkovModel &model, Options options);
+
+  /**
+   * @brief Read and answer lines until the end of the stream or :quit
+   * @param in lines typed at the prompt
+   */
+  void run(istream &in);
+
+private:
+  enum Mode { SAMPLE, BEST, DISTINCT };
+
+  const MarkovModel *model;
+  int sentenceCount;
+  Mode mode;
+  bool useSeed;
+  uint64_t seed;
+
+  /**
+   * @brief Apply a ':' command
+   * @param command line without the leading ':'
+   * @return false if the prompt should exit
+   */
+  bool runCommand(const string &command);
+
+  /**
+   * @brief Compile a constraint and print its sentences and timings
+   * @param constraint constraint as typed
+   */
+  void answer(const string &constraint);
+
+  void printSettings() const;
+
+  static void printHelp();
+};
+
+#endif
@@ -0,0 +1,108 @@
+#include "scorer.h"
+
+#include <vector>
+#include <math.h>
+
+#include "utils.h"
+#include "taskpool.h"
+
+
+double ScoreSummary::getPerplexity() const {
+  return (wordCount > 0) ? exp(-logProb / wordCount) : INFINITY;
+}
+
+
+double ScoreSummary::getUnscoredWordShare() const {
+  long totalWordCount = wordCount + unscoredWordCount;
+  return (totalWordCount > 0) ? (double)unscoredWordCount / totalWordCount : 0.0;
+}
+
+
+Scorer::Scorer(const MarkovModel &model) {
+  this->model = &model;
+}
+
+
+ScoreSummary Scorer::scoreStream(istream &in, FILE *out) {
+  TaskPool &taskPool = TaskPool::getInstance();
+  int chunksInFlight = taskPool.getThreadCount() * 2;
+
+  ScoreSummary total;
+  vector<string> chunks;
+  string carry;
+  vector<char> buffer(CHUNK_SIZE);
+
+  while (in || !carry.empty()) {
+    // Read the next chunk and cut it after its last sentence delimiter
+    in.read(buffer.data(), buffer.size());
+    carry.append(buffer.data(), in.gcount());
+    size_t cut = carry.find_last_of(".?!");
+    if (!in) {
+      cut = carry.size();
+    } else if (cut == string::npos) {
+      // No sentence ends in a whole chunk; cut at a word boundary instead
+      cut = (carry.size() >= 4 * CHUNK_SIZE) ? carry.find_last_of(" \t\n") : string::npos;
+      if (cut == string::npos) {
+        continue;
+      }
+    } else {
+      cut++;
+    }
+    chunks.push_back(carry.substr(0, cut));
+    carry.erase(0, cut);
+
+    if ((int)chunks.size() < chunksInFlight && in) {
+      continue;
+    }
+
+    // Score the chunks in parallel, then write them in order
+    vector<string> outputs(chunks.size());
+    vector<ScoreSummary> summaries(chunks.size());
+    taskPool.parallelFor(0, (int)chunks.size(), 1, [&](int begin, int end) {
+      for (int i = begin; i < end; i++) {
+        scoreChunk(chunks[i], outputs[i], summaries[i]);
+      }
+    });
+    for (int i = 0; i < (int)chunks.size(); i++) {
+      fwrite(outputs[i].data(), 1, outputs[i].size(), out);
+      total.sentenceCount += summaries[i].sentenceCount;
+      total.unscoredCount += summaries[i].unscoredCount;
+      total.wordCount += summaries[i].wordCount;
+      total.unscoredWordCount += summaries[i].unscoredWordCount;
+      total.logProb += summaries[i].logProb;
+    }
+    chunks.clear();
+  }
+
+  return total;
+}
+
+
+void Scorer::scoreChunk(const string &text, string &output, ScoreSummary &summary) const {
+  char score[64];
+
+  for (const auto &sentence : Utils::processTrainingSentences(text, 0)) {
+    if (sentence.empty()) {
+      continue;
+    }
+    double logProb = model->getSentenceLogProbability(model->getWordIds(sentence));
+
+    summary.sentenceCount++;
+    if (isinf(logProb)) {
+      summary.unscoredCount++;
+      summary.unscoredWordCount += sentence.size();
+      snprintf(score, sizeof(score), "-inf\t%d\t", (int)sentence.size());
+    } else {
+      summary.wordCount += sentence.size();
+      summary.logProb += logProb;
+      snprintf(score, sizeof(score), "%f\t%d\t", logProb, (int)sentence.size());
+    }
+
+    output += score;
+    for (int i = 0; i < (int)sentence.size(); i++) {
+      output += (i > 0) ? " " : "";
+      output += sentence[i];
+    }
+    output += "\n";
+  }
+}
@@ -0,0 +1,89 @@
+#ifndef MARKOV_SCORER_H
+#define MARKOV_SCORER_H
+
+#include <string>
+#include <istream>
+#include <stdio.h>
+
+#include "models/markov.h"
+
+using namespace std;
+
+
+/**
+ * @brief Totals of a scoring run
+ */
+struct ScoreSummary {
+  /// Sentences read
+  long sentenceCount = 0;
+  /// Sentences the model cannot produce (unknown word or unseen transition)
+  long unscoredCount = 0;
+  /// Words of the scored sentences
+  long wordCount = 0;
+  /// Words of the unscored sentences
+  long unscoredWordCount = 0;
+  /// Sum of the natural log probabilities of the scored sentences
+  double logProb = 0.0;
+
+  /**
+   * @brief Get the perplexity per word of the scored sentences
+   *
+   * Unscored sentences are left out (no smoothing), so the perplexity
+   * must be read together with getUnscoredWordShare()
+   *
+   * @return double perplexity (exp of the negative mean log probability)
+   */
+  double getPerplexity() const;
+
+  /**
+   * @brief Get the share of the words left out of the perplexity
+   * @return double words of unscored sentences over all words (0 if there are none)
+   */
+  double getUnscoredWordShare() const;
+};
+
+
+/**
+ * @brief Scores text against a trained markov model in bulk
+ *
+ * Text is streamed in chunks cut at sentence boundaries. Chunks are
+ * tokenized like training text and scored on the TaskPool, a bounded
+ * number at a time, and written back in input order, so memory does
+ * not grow with the input.
+ */
+class Scorer {
+public:
+  /**
+   * @param model trained markov model (must outlive the scorer)
+   */
+  Scorer(const MarkovModel &model);
+
+  /**
+   * @brief Score every sentence of a stream
+   *
+   * Writes one line per sentence: natural log probability, word count
+   * and the tokenized sentence, separated by tabs ("-inf" if the
+   * model cannot produce the sentence)
+   *
+   * @param in text to score
+   * @param out destination of the per-sentence scores
+   * @return ScoreSummary totals
+   */
+  ScoreSummary scoreStream(istream &in, FILE *out);
+
+private:
+  /// Bytes of text per chunk
+  static const size_t CHUNK_SIZE = 1 << 20;
+
+  const MarkovModel *model;
+
+  /**
+   * @brief Tokenize and score one chunk
+   * @param text chunk ending at a sentence boundary
+   * @param output formatted score lines
+   * @param summary totals of the chunk
+   */
+  void scoreChunk(const string &text, string &output, ScoreSummary &summary) const;
+};
+
+#endif
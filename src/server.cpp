@@ -1,5 +1,6 @@
 #include <unistd.h> 
 #include <stdio.h> 
+#include <stdlib.h>
 #include <sys/socket.h> 
 #include <netinet/in.h>
 #include <arpa/inet.h>
@@ -25,6 +26,7 @@ Server::Server(int port, Options options, int threadCount, int bufferSize) {
   this->threadCount = (threadCount < 1) ? 1 : threadCount;
   this->bufferSize = bufferSize;
   this->shouldStop = false;
+  this->sessions.setTimeout(options.getSessionTimeout());
 }
 
 
@@ -42,7 +44,8 @@ void Server::startServerLoop() {
   for(int i = 0; i < this->threadCount; i++) {
     std::thread worker(performWork, i, &this->shouldStop,
                        &this->queue, &this->mutex, &this->cv,
-                       &this->options, &this->markovModel);
+                       &this->options, &this->markovModel,
+                       &this->sessions);
     this->threadPool.push_back(&worker);
     worker.detach();
   }
@@ -58,10 +61,86 @@ void Server::stop() {
 }
 
 
+/**
+ * @brief Format sampled words as a response section
+ * 
+ * @param samples sampled words by constraint position, one per sentence
+ * @param sentenceCount number of sentences
+ * @return string each sentence's words separated by ::
+ */
+static string formatSampledWords(const vector<vector<string> > &samples, int sentenceCount) {
+  string builder;
+  for (int i = 0; i < sentenceCount; i++) {
+    for (int j = 0; j < (int)samples.size(); j++) {
+      builder += samples[j][i] + " ";
+    }
+    builder += "::";
+  }
+  if (sentenceCount > 0) {
+    builder.pop_back();
+    builder.pop_back();
+  }
+  return builder;
+}
+
+
+/**
+ * @brief Build the response sent back to a client
+ * 
+ * Sections are separated by $$$ and items by ::
+ * sentences $$$ words removed by constraints $$$ words removed by
+ * arc consistency $$$ total solution count :: log10 of the count
+ * 
+ * @param removedByArcConsistency sampled words removed by the backward
+ *        arc consistency pass, by constraint position ("" where none)
+ */
+template <class Model>
+static string buildResponse(Model &model, const vector<vector<string> > &generatedSentences,
+                            const vector<vector<string> > &removedByArcConsistency) {
+  string builder;
+  int sentenceCount = (int)generatedSentences.size();
+
+  // Mnemonic sentences
+  for (const auto &sentence : generatedSentences) {
+    for (const auto &word : sentence) {
+      builder += word + " ";
+    }
+    builder += "::";
+  }
+  if (!generatedSentences.empty()) {
+    builder.pop_back();
+    builder.pop_back();
+  }
+
+  builder += "$$$";
+
+  // Words removed by constraints
+  vector<vector<string> > removedByConstraint(model.getSentenceLength());
+  for (int j = 0; j < model.getSentenceLength(); j++) {
+    removedByConstraint[j] = model.sampleRemovedNodesByConstraint(j, sentenceCount);
+  }
+  builder += formatSampledWords(removedByConstraint, sentenceCount);
+
+  builder += "$$$";
+
+  // Words removed by Arc consistency
+  builder += formatSampledWords(removedByArcConsistency, sentenceCount);
+
+  builder += "$$$";
+
+  // Total solution count (exact or estimate) :: log10 of the count
+  SolutionCount solutionCount = model.getTotalSolutionCount();
+  builder += solutionCount.toString() + "::" + to_string(solutionCount.log10Count);
+
+  return builder;
+}
+
+
 void Server::performWork(int threadID, bool *shouldStop,
                          std::unique_ptr<ThreadQueue<ConnectionData> > *queue,
                          std::mutex *mutex, std::condition_variable *cv,
-                         Options *options, MarkovModel *markovModel) {
+                         Options *options, MarkovModel *markovModel,
+                         SessionStore *sessions) {
   while (!*shouldStop) {
     ConnectionData data;
     // Wait for queue element
@@ -71,49 +150,44 @@ void Server::performWork(int threadID, bool *shouldStop,
       cv->wait(lock);  // Non-busy wait on thread
     }
 
-    Console::debugPrint("Thread %d working on constraint: %s\n", threadID, Utils::cleanConstraint(data.constraint).c_str());
-
-    auto model = MnemonicMarkovModel(*markovModel, Utils::cleanConstraint(data.constraint), *options);
-    model.printDebugInfo(*options);
-    auto generatedSentences = model.generateSentences(*options);
+    string constraint;
+    std::unordered_map<string, string> requestOptions;
+    parseRequest(data.request, constraint, requestOptions);
 
-
-    // Send sentences + data back to client
     string builder;
+    auto modeOption = requestOptions.find("mode");
+    string mode = (modeOption != requestOptions.end()) ? modeOption->second : "";
+    auto sessionOption = requestOptions.find("session");
+    if (sessionOption != requestOptions.end()) {
+      Console::debugPrint("Thread %d working on session: %s\n", threadID, sessionOption->second.c_str());
+      builder = performSessionWork(sessionOption->second, constraint, requestOptions, options, markovModel, sessions);
 
-    // Mnemonic sentences
-    for (const auto &sentence : generatedSentences) {
-      for (const auto &word : sentence) {
-        builder += word + " ";
-      }
-      builder += "::";
-    }
-    builder.pop_back();
-    builder.pop_back();
-
-    builder += "$$$";
+    } else {
+      Console::debugPrint("Thread %d working on constraint: %s\n", threadID, Utils::cleanConstraint(constraint).c_str());
 
-    // Words removed by constraints
-    for (int i = 0; i < generatedSentences.size(); i++) {
-      for (int j = 0; j < model.getSentenceLength(); j++) {
-        builder += model.sampleRemovedNodeByConstraint(j) + " ";
+      auto model = MnemonicMarkovModel(*markovModel, Utils::cleanConstraint(constraint), *options);
+      auto seedOption = requestOptions.find("seed");
+      if (seedOption != requestOptions.end()) {
+        model.setSeed(strtoull(seedOption->second.c_str(), nullptr, 10));
+      }
+      model.printDebugInfo(*options);
+      vector<vector<string> > generatedSentences;
+      if (mode == "best") {
+        generatedSentences = model.generateBestSentences(options->getSentenceCount());
+      } else if (mode == "distinct") {
+        generatedSentences = model.sampleDistinctSentences(options->getSentenceCount());
+      } else {
+        generatedSentences = model.generateSentences(*options);
       }
-      builder += "::";
-    }
-    builder.pop_back();
-    builder.pop_back();
-
-    builder += "$$$";
 
-    // Words removed by Arc consistency
-    for (int i = 0; i < generatedSentences.size(); i++) {
+      // Send sentences + data back to client
+      int sentenceCount = (int)generatedSentences.size();
+      vector<vector<string> > removedByArcConsistency(model.getSentenceLength());
       for (int j = 0; j < model.getSentenceLength(); j++) {
-        builder += model.sampleRemovedNodeByArcConsistency(j) + " ";
+        removedByArcConsistency[j] = model.sampleRemovedNodesByArcConsistency(j, sentenceCount);
       }
-      builder += "::";
+      builder = buildResponse(model, generatedSentences, removedByArcConsistency);
     }
-    builder.pop_back();
-    builder.pop_back();
 
     int sval = write(data.accepted_fd, builder.c_str(), builder.size());
     if (sval < 0) {
@@ -124,6 +198,103 @@ void Server::performWork(int threadID, bool *shouldStop,
 }
 
 
+string Server::performSessionWork(const string &sessionOption, const string &constraint,
+                                  const std::unordered_map<string, string> &requestOptions,
+                                  Options *options, MarkovModel *markovModel,
+                                  SessionStore *sessions) {
+  int sessionId;
+  std::shared_ptr<SessionStore::Session> session;
+  string appendConstraint = constraint;
+
+  if (sessionOption == "open") {
+    session = sessions->open(*markovModel, sessionId);
+  } else {
+    sessionId = atoi(sessionOption.c_str());
+    if (requestOptions.count("close")) {
+      sessions->close(sessionId);
+      return "closed$$$session=" + to_string(sessionId);
+    }
+    session = sessions->find(sessionId);
+    if (!session) {
+      return "ERROR::Unknown session " + sessionOption;
+    }
+    auto appendOption = requestOptions.find("append");
+    if (appendOption != requestOptions.end()) {
+      appendConstraint = appendOption->second;
+    }
+  }
+
+  // Requests on the same session are applied one at a time
+  std::unique_lock<std::mutex> lock(session->mutex);
+  CompileSession &compileSession = *session->compileSession;
+
+  time_t startTime = clock();
+  auto removeOption = requestOptions.find("remove");
+  if (removeOption != requestOptions.end()) {
+    int removeCount = removeOption->second.empty() ? 1 : atoi(removeOption->second.c_str());
+    for (int i = 0; i < removeCount; i++) {
+      compileSession.removeConstraint();
+    }
+  }
+  if (!appendConstraint.empty()) {
+    for (const auto &token : Utils::splitAndLower(Utils::cleanConstraint(appendConstraint), "\\s,")) {
+      compileSession.appendConstraint(token);
+    }
+  }
+  Console::debugPrint("%-35s: %f\n", "Elapsed Session Update Time", (float)(clock() - startTime) / CLOCKS_PER_SEC);
+
+  auto seedOption = requestOptions.find("seed");
+  if (seedOption != requestOptions.end()) {
+    compileSession.setSeed(strtoull(seedOption->second.c_str(), nullptr, 10));
+  }
+
+  auto modeOption = requestOptions.find("mode");
+  string mode = (modeOption != requestOptions.end()) ? modeOption->second : "";
+  vector<vector<string> > generatedSentences;
+  if (mode == "best") {
+    generatedSentences = compileSession.generateBestSentences(options->getSentenceCount());
+  } else if (mode == "distinct") {
+    generatedSentences = compileSession.sampleDistinctSentences(options->getSentenceCount());
+  } else {
+    generatedSentences = compileSession.generateSentences(options->getSentenceCount());
+  }
+  // Sessions only prune forward, so their arc consistency section is left
+  // empty and the words unreachable from START get a section of their own
+  int sentenceCount = (int)generatedSentences.size();
+  int sentenceLength = compileSession.getSentenceLength();
+  vector<vector<string> > unreachable(sentenceLength);
+  for (int j = 0; j < sentenceLength; j++) {
+    unreachable[j] = compileSession.sampleUnreachableNodes(j, sentenceCount);
+  }
+  vector<vector<string> > noneRemoved(sentenceLength, vector<string>(sentenceCount, ""));
+  return buildResponse(compileSession, generatedSentences, noneRemoved) + "$$$session=" + to_string(sessionId)
+         + "$$$unreachable=" + formatSampledWords(unreachable, sentenceCount);
+}
+
+
+void Server::parseRequest(const string &request, string &constraint,
+                          std::unordered_map<string, string> &requestOptions) {
+  const string separator = "$$$";
+  size_t end = request.find(separator);
+  constraint = request.substr(0, end);
+
+  while (end != string::npos) {
+    size_t begin = end + separator.size();
+    end = request.find(separator, begin);
+    string option = request.substr(begin, (end == string::npos) ? string::npos : end - begin);
+    if (option.empty()) {
+      continue;
+    }
+    size_t equals = option.find('=');
+    if (equals == string::npos) {
+      requestOptions[option] = "";
+    } else {
+      requestOptions[option.substr(0, equals)] = option.substr(equals + 1);
+    }
+  }
+}
+
+
 void Server::startConnectionBrokerLoop(int server_fd, Options options) {
   char buffer[this->bufferSize];
 
@@ -140,7 +311,7 @@ void Server::startConnectionBrokerLoop(int server_fd, Options options) {
     } else {
       ConnectionData data;
       data.accepted_fd = accepted_fd;
-      data.constraint = buffer;
+      data.request = buffer;
       this->queue->push(data);  // worker threads are notified on push
     }
   }
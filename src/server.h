@@ -4,19 +4,37 @@
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <unordered_map>
 
 #include "threadqueue.h"
 #include "options.h"
 #include "models/markov.h"
+#include "sessionstore.h"
 
 struct ConnectionData {
   int accepted_fd;
-  string constraint;
+  string request;
 };
 
 /**
  * @brief Server to connect to client(s) via sockets
  * 
+ * A request is a constraint optionally followed by options, all
+ * separated by $$$ (e.g. "t w s$$$session=open"):
+ * 
+ * session=open              open a compile session extended by the constraint
+ * session=<id>$$$append=c   append constraint c to the session
+ * session=<id>$$$remove=n   remove the last n constraints (default 1)
+ * session=<id>$$$close      close the session
+ * mode=best                 most probable sentences instead of samples
+ * mode=distinct             samples without duplicates
+ * seed=n                    seed the request's (or session's) random generator
+ * 
+ * Session responses end with $$$session=<id>$$$unreachable=<words>,
+ * words satisfying the constraint but unreachable from the previous
+ * positions. Sessions do not run the backward arc consistency pass, so
+ * their arc consistency section is empty. Sessions idle longer than
+ * --sessiontimeout seconds are closed.
  */
 class Server {
 public:
@@ -29,7 +47,18 @@ public:
   static void performWork(int threadID, bool *shouldStop,
                           std::unique_ptr<ThreadQueue<ConnectionData> > *queue,
                           std::mutex *mutex, std::condition_variable *cv,
-                          Options *options, MarkovModel *markovModel);
+                          Options *options, MarkovModel *markovModel,
+                          SessionStore *sessions);
+
+  /**
+   * @brief Split a request into its constraint and options
+   * 
+   * @param request raw request read from the client
+   * @param constraint set to the constraint part
+   * @param requestOptions set to the key=value options (value "" if omitted)
+   */
+  static void parseRequest(const string &request, string &constraint,
+                           std::unordered_map<string, string> &requestOptions);
 
 private:
   std::mutex mutex;
@@ -46,6 +75,7 @@ private:
 
   Options options;
   MarkovModel markovModel;
+  SessionStore sessions;
 
   int createSocket(int port);
 
@@ -53,6 +83,11 @@ private:
 
   void startConnectionBrokerLoop(int server_fd, Options options);
 
+  static string performSessionWork(const string &sessionOption, const string &constraint,
+                                   const std::unordered_map<string, string> &requestOptions,
+                                   Options *options, MarkovModel *markovModel,
+                                   SessionStore *sessions);
+
 };
 
 #endif
@@ -0,0 +1,63 @@
+#include "sessionstore.h"
+
+#include "models/mnemonicmarkov.h"
+
+
+SessionStore::SessionStore(int timeoutSeconds) {
+  this->timeout = std::chrono::seconds(timeoutSeconds);
+  this->nextSessionId = 1;
+}
+
+
+std::shared_ptr<SessionStore::Session> SessionStore::open(const MarkovModel &model, int &sessionId) {
+  auto session = std::make_shared<Session>();
+  session->compileSession = std::unique_ptr<CompileSession>(new CompileSession(model, std::make_shared<MnemonicMarkovModel>()));
+
+  std::unique_lock<std::mutex> lock(this->mutex);
+  auto now = std::chrono::steady_clock::now();
+  expire(now);
+
+  sessionId = this->nextSessionId++;
+  Entry &entry = this->sessions[sessionId];
+  entry.session = session;
+  entry.lastUsed = now;
+  return session;
+}
+
+
+std::shared_ptr<SessionStore::Session> SessionStore::find(int sessionId) {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  auto now = std::chrono::steady_clock::now();
+  expire(now);
+
+  auto entry = this->sessions.find(sessionId);
+  if (entry == this->sessions.end()) {
+    return nullptr;
+  }
+  entry->second.lastUsed = now;
+  return entry->second.session;
+}
+
+
+bool SessionStore::close(int sessionId) {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  return this->sessions.erase(sessionId) > 0;
+}
+
+
+void SessionStore::setTimeout(int timeoutSeconds) {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  this->timeout = std::chrono::seconds(timeoutSeconds);
+}
+
+
+void SessionStore::expire(std::chrono::steady_clock::time_point now) {
+  // Sessions still in use by a worker stay alive through their shared_ptr
+  for (auto it = this->sessions.begin(); it != this->sessions.end();) {
+    if (now - it->second.lastUsed > this->timeout) {
+      it = this->sessions.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
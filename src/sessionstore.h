@@ -0,0 +1,69 @@
+#ifndef SESSIONSTORE_H
+#define SESSIONSTORE_H
+
+#include <mutex>
+#include <chrono>
+#include <memory>
+#include <unordered_map>
+
+#include "models/markov.h"
+#include "models/compilesession.h"
+
+/**
+ * @brief Open compile sessions of the server, expired after an idle timeout
+ */
+class SessionStore {
+public:
+  /**
+   * @brief A compile session and the lock serializing requests on it
+   */
+  struct Session {
+    std::mutex mutex;
+    std::unique_ptr<CompileSession> compileSession;
+  };
+
+  SessionStore(int timeoutSeconds = 300);
+  ~SessionStore() {};
+
+  /**
+   * @brief Open a new empty session
+   *
+   * @param model trained markov model the session extends
+   * @param sessionId set to the id of the new session
+   * @return std::shared_ptr<Session> the new session
+   */
+  std::shared_ptr<Session> open(const MarkovModel &model, int &sessionId);
+
+  /**
+   * @brief Find an open session and mark it as used
+   *
+   * @param sessionId id returned by open
+   * @return std::shared_ptr<Session> session or nullptr if unknown or expired
+   */
+  std::shared_ptr<Session> find(int sessionId);
+
+  /**
+   * @brief Close a session
+   *
+   * @param sessionId id returned by open
+   * @return true if the session was open
+   */
+  bool close(int sessionId);
+
+  void setTimeout(int timeoutSeconds);
+
+private:
+  struct Entry {
+    std::shared_ptr<Session> session;
+    std::chrono::steady_clock::time_point lastUsed;
+  };
+
+  std::mutex mutex;
+  std::unordered_map<int, Entry> sessions;
+  std::chrono::seconds timeout;
+  int nextSessionId;
+
+  void expire(std::chrono::steady_clock::time_point now);
+};
+
+#endif
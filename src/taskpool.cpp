@@ -0,0 +1,98 @@
+#include "taskpool.h"
+
+#include <algorithm>
+
+
+TaskPool &TaskPool::getInstance() {
+  static TaskPool instance;
+  return instance;
+}
+
+
+TaskPool::TaskPool() {
+  this->threadCount = 1;
+  this->shouldStop = false;
+}
+
+
+TaskPool::~TaskPool() {
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    this->shouldStop = true;
+  }
+  this->cv.notify_all();
+  for (auto &thread : this->threads) {
+    thread.join();
+  }
+}
+
+
+void TaskPool::setThreadCount(int threadCount) {
+  std::unique_lock<std::mutex> lock(this->mutex);
+  this->threadCount = std::max(1, threadCount);
+
+  // The caller of each loop is one of the threads
+  while ((int)this->threads.size() < this->threadCount - 1) {
+    this->threads.emplace_back(&TaskPool::workerLoop, this);
+  }
+}
+
+
+void TaskPool::run(int begin, int end, int grainSize, const std::function<void(int, int)> &f) {
+  int count = end - begin;
+  int chunkSize = std::max(std::max(grainSize, 1), (count + this->threadCount * 4 - 1) / (this->threadCount * 4));
+
+  auto batch = std::make_shared<Batch>();
+  batch->f = &f;
+  batch->begin = begin;
+  batch->end = end;
+  batch->chunkSize = chunkSize;
+  batch->chunkCount = (count + chunkSize - 1) / chunkSize;
+  batch->nextChunk = 0;
+  batch->doneChunks = 0;
+
+  int helperCount = std::min(this->threadCount - 1, batch->chunkCount - 1);
+  {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    for (int i = 0; i < helperCount; i++) {
+      this->queue.push_back(batch);
+    }
+  }
+  this->cv.notify_all();
+
+  // Work on the loop, then wait for chunks still running on helpers
+  batch->work();
+  std::unique_lock<std::mutex> lock(batch->mutex);
+  batch->cv.wait(lock, [&batch]() { return batch->doneChunks == batch->chunkCount; });
+}
+
+
+void TaskPool::Batch::work() {
+  int chunk;
+  while ((chunk = this->nextChunk++) < this->chunkCount) {
+    int chunkBegin = this->begin + chunk * this->chunkSize;
+    (*this->f)(chunkBegin, std::min(chunkBegin + this->chunkSize, this->end));
+
+    if (++this->doneChunks == this->chunkCount) {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->cv.notify_all();
+    }
+  }
+}
+
+
+void TaskPool::workerLoop() {
+  while (true) {
+    std::shared_ptr<Batch> batch;
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->cv.wait(lock, [this]() { return this->shouldStop || !this->queue.empty(); });
+      if (this->shouldStop) {
+        return;
+      }
+      batch = this->queue.front();
+      this->queue.pop_front();
+    }
+    batch->work();
+  }
+}
@@ -0,0 +1,97 @@
+#ifndef TASKPOOL_H
+#define TASKPOOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <functional>
+
+/**
+ * @brief Process-wide pool of threads shared by every request for
+ * data-parallel loops (e.g. compiling the layers of one constraint)
+ *
+ * The calling thread always works on its own loop, so loops may be
+ * nested and a pool of one thread simply runs everything inline.
+ */
+class TaskPool {
+public:
+  /**
+   * @brief Get the shared pool
+   * @return TaskPool& pool
+   */
+  static TaskPool &getInstance();
+
+  /**
+   * @brief Set the number of threads working on each loop
+   *
+   * Should be called once before the pool is used
+   *
+   * @param threadCount threads including the caller (1 runs loops inline)
+   */
+  void setThreadCount(int threadCount);
+
+  int getThreadCount() const { return this->threadCount; }
+
+  /**
+   * @brief Run f(chunkBegin, chunkEnd) over chunks covering [begin, end)
+   *
+   * Ranges no larger than grainSize run inline on the calling thread;
+   * otherwise chunks hold at least grainSize items. Returns once every
+   * chunk is done.
+   *
+   * @param begin first item
+   * @param end item past the last item
+   * @param grainSize smallest range worth splitting
+   * @param f callback taking a chunk [chunkBegin, chunkEnd)
+   */
+  template <class F>
+  void parallelFor(int begin, int end, int grainSize, F f) {
+    if (end - begin <= grainSize || this->threadCount <= 1) {
+      if (end > begin) {
+        f(begin, end);
+      }
+      return;
+    }
+    run(begin, end, grainSize, std::function<void(int, int)>(f));
+  }
+
+private:
+  /**
+   * @brief Chunks of one loop, claimed by the caller and helper threads
+   */
+  struct Batch {
+    const std::function<void(int, int)> *f;
+    int begin;
+    int end;
+    int chunkSize;
+    int chunkCount;
+    std::atomic<int> nextChunk;
+    std::atomic<int> doneChunks;
+    std::mutex mutex;
+    std::condition_variable cv;
+
+    void work();
+  };
+
+  int threadCount;
+  bool shouldStop;
+  std::vector<std::thread> threads;
+  std::deque< std::shared_ptr<Batch> > queue;
+  std::mutex mutex;
+  std::condition_variable cv;
+
+  TaskPool();
+  ~TaskPool();
+  TaskPool(const TaskPool &) = delete;
+  TaskPool &operator=(const TaskPool &) = delete;
+
+  void run(int begin, int end, int grainSize, const std::function<void(int, int)> &f);
+
+  void workerLoop();
+};
+
+#endif
@@ -127,16 +127,20 @@ string Utils::readInTrainingSentences(string filePath) {
 }
 
 
-vector<vector<string> > Utils::processTrainingSentences(string text, int trainingSentenceLimit, int markovOrder) {
+vector<vector<string> > Utils::processTrainingSentences(const string &text, int trainingSentenceLimit) {
   vector<vector<string> > data;
 
-  // Split the line along delimiters for sentences
-  vector<string> sentences = Utils::splitAndLower(text, ".?!");
+  // Split the text along delimiters for sentences, one at a time so tokenizing stops at the limit
+  boost::regex sentenceExp("[^.?!]+");
+  auto begin = boost::sregex_iterator(text.begin(), text.end(), sentenceExp);
+  auto end = boost::sregex_iterator();
 
   // Split up words in sentences
-  data.reserve(sentences.size());
-  for (const string &sentence : sentences) {
+  string sentence;
+  for (; begin != end && (trainingSentenceLimit <= 0 || (int)data.size() < trainingSentenceLimit); begin++) {
     // TODO: attach part of speech to word
+    sentence = begin->str();
+    transform(sentence.begin(), sentence.end(), sentence.begin(), ::tolower);
 
     vector<string> words = Utils::split(sentence, "\\s,#@$%&;:\"\\(\\)0-9");
 //    vector<string> words = Utils::split(sentence, "\\s0-9");
@@ -157,36 +161,19 @@ vector<vector<string> > Utils::processTrainingSentences(string text, int trainin
       }
     }
 
-
-    // Combine words to increase the markov order
-    if (markovOrder > 1) {
-      vector<string> combinedWords;
-      combinedWords.reserve(words.size() / markovOrder);
-      for (int i = 0; i < words.size(); i += markovOrder) {
-        string word;
-        for (int j = i; j < words.size() && j < i + markovOrder; j++) {
-          word += words[j] + " ";
-        }
-        word.pop_back(); // remove extra space
-
-        combinedWords.push_back(word);
-      }
-      data.push_back(combinedWords);
-    } else {
-      data.push_back(words);
-    }
-  }
-
-  if (trainingSentenceLimit != 0) { // if there is a sentence limit
-    vector<vector<string> > newData(trainingSentenceLimit);
-    std::copy(data.begin(), data.begin() + trainingSentenceLimit, newData.begin());
-    data = newData;
+    data.push_back(move(words));
   }
 
   return data;
 }
 
 
+bool Utils::isCached(string fileName) {
+  struct stat info;
+  return stat((Utils::cacheDirectory + fileName + Utils::cacheSuffix).c_str(), &info) == 0;
+}
+
+
 string Utils::getBasename(string filePath) {
   string basename;
   boost::regex directoryExp("[^/]+");
@@ -201,6 +188,14 @@ string Utils::getBasename(string filePath) {
 }
 
 
+uint64_t Utils::hashText(const string &text, uint64_t hash) {
+  for (unsigned char c : text) {
+    hash = (hash ^ c) * 1099511628211ULL;
+  }
+  return hash;
+}
+
+
 bool Utils::isStopWord(string word) {
   return std::find(STOP_WORDS.begin(), STOP_WORDS.end(), word) != STOP_WORDS.end();
 }
\ No newline at end of file
@@ -88,15 +88,15 @@ namespace Utils {
    * @brief Process training sentences
    *
    * Condense expanded contractions in COCA dataset
-   * Combine words for higher than 1 markov order
+   * (higher markov orders are handled by the model's context states)
    *
    * @param text entire input text
    * @param trainingSentenceLimit cut off for how many sentences are used
-   * @param markovOrder lookahead for markov model
+   *        (0 for no limit; the text past the limit is not tokenized)
    * @return 2D vector of words in sentences
    * @author Porter Glines 3/5/19
    */
-  vector< vector<string> > processTrainingSentences(string text, int trainingSentenceLimit, int markovOrder=1);
+  vector< vector<string> > processTrainingSentences(const string &text, int trainingSentenceLimit);
 
   /**
    * Read from cache
@@ -114,7 +114,14 @@ namespace Utils {
    * @author Porter Glines 5/13/19
    */
   template <class T>
-  void writeToCache(T data, string fileName);
+  void writeToCache(const T &data, string fileName);
+
+  /**
+   * @brief Check whether a cache file exists
+   * @param fileName name of original data source file
+   * @return true if it was written to the cache
+   */
+  bool isCached(string fileName);
 
   /**
    * @brief returns the basename for a Unix filepath
@@ -125,6 +132,14 @@ namespace Utils {
    */
   string getBasename(string filePath);
 
+  /**
+   * @brief Hash text (64-bit FNV-1a), e.g. to name cache files by their sources
+   * @param text text to hash
+   * @param hash hash of the text before it, to hash several pieces in turn
+   * @return uint64_t hash of the text
+   */
+  uint64_t hashText(const string &text, uint64_t hash = 14695981039346656037ULL);
+
   /**
    * @brief returns true if the given word is a stop word
    * 
@@ -19,7 +19,7 @@ void Utils::readFromCache(T &ret, string fileName) {
 
 
 template <class T>
-void Utils::writeToCache(T data, string fileName) {
+void Utils::writeToCache(const T &data, string fileName) {
 
   // Create cache directory if it doesn't already exist
   if (mkdir(Utils::cacheDirectory.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1) {